@@ -4,11 +4,94 @@
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 
+#include <algorithm>
 #include <cstring>
 #include "BTreeNode.h"
 
 using namespace std;
 
+/***********
+ * Posting *
+ ***********/
+
+// Append n to bytes, seven bits at a time, low bits first.
+static void put_varint(string &bytes, uint32_t n) {
+    while (n >= 0x80) {
+        bytes.push_back((char) ((n & 0x7f) | 0x80));
+        n >>= 7;
+    }
+    bytes.push_back((char) n);
+}
+
+// Read a varint written by put_varint, moving past it.
+static uint32_t get_varint(const char *&bytes) {
+    uint32_t n = 0;
+    for (uint shift = 0;; shift += 7) {
+        uint8_t byte = (uint8_t) *bytes++;
+        n |= (uint32_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return n;
+    }
+}
+
+static uint varint_size(uint32_t n) {
+    uint size = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Append a handle as its distance from the one before it (prev starts out as (0, 0)).
+static void encode_handle(string &bytes, Handle handle, Handle &prev) {
+    if (handle.first == prev.first) {
+        put_varint(bytes, 0);
+        put_varint(bytes, handle.second - prev.second);
+    } else {
+        put_varint(bytes, handle.first - prev.first);
+        put_varint(bytes, handle.second);
+    }
+    prev = handle;
+}
+
+static Handle decode_handle(const char *&bytes, Handle &prev) {
+    uint32_t gap = get_varint(bytes);
+    if (gap == 0)
+        prev.second = (RecordID) (prev.second + get_varint(bytes));
+    else
+        prev = Handle(prev.first + gap, (RecordID) get_varint(bytes));
+    return prev;
+}
+
+static uint encoded_size(Handle handle, Handle &prev) {
+    uint size;
+    if (handle.first == prev.first)
+        size = 1 + varint_size(handle.second - prev.second);
+    else
+        size = varint_size(handle.first - prev.first) + varint_size(handle.second);
+    prev = handle;
+    return size;
+}
+
+static uint encoded_size(const Handles &handles) {
+    uint size = 0;
+    Handle prev(0, 0);
+    for (auto const &handle: handles)
+        size += encoded_size(handle, prev);
+    return size;
+}
+
+// Marshalled as a varint header of the count shifted left one (with the low bit set for an overflow list),
+// followed by either the encoded handles or the first overflow block id.
+uint Posting::size() const {
+    uint header = varint_size(this->count << 1 | 1);
+    if (!this->loaded || this->overflow != 0)
+        return header + sizeof(BlockID);
+    uint size = encoded_size(this->handles);
+    return size > MAX_INLINE ? header + sizeof(BlockID) : header + size;
+}
+
 /************************
  * BTreeNode base class *
  ************************/
@@ -52,36 +135,37 @@ Handle BTreeNode::get_handle(RecordID record_id) const {
     return Handle(handle_block_id, handle_record_id);
 }
 
-// Get the record and turn it into a KeyValue.
-KeyValue *BTreeNode::get_key(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
-    KeyValue *key_value = new KeyValue();
-    Value value;
-    uint offset = 0;
-    for (auto const &data_type: this->key_profile) {
-        value.data_type = data_type;
-        if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *) (bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
-        }
-        key_value->push_back(value);
-    }
-    delete dbt;
-    return key_value;
+// Get the record holding a marshalled key.
+KeyBytes BTreeNode::get_key(RecordID record_id) const {
+    Dbt data;
+    this->block->get(record_id, data);
+    return KeyBytes((const char *) data.get_data(), data.get_size());
+}
+
+// Compare the key in a record with key, without copying it out of the block.
+int BTreeNode::compare_key(RecordID record_id, const KeyBytes &key, uint skip) const {
+    Dbt data;
+    this->block->get(record_id, data);
+    return compare((const char *) data.get_data(), data.get_size(), key.data() + skip, (uint) key.size() - skip);
+}
+
+int BTreeNode::compare(const char *a, uint a_size, const char *b, uint b_size) {
+    int cmp = memcmp(a, b, min(a_size, b_size));
+    if (cmp != 0)
+        return cmp;
+    return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+}
+
+uint BTreeNode::common_prefix(const KeyBytes &a, const KeyBytes &b) {
+    uint n = (uint) min(a.size(), b.size());
+    uint i = 0;
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+KeyBytes BTreeNode::separator(const KeyBytes &left, const KeyBytes &right) {
+    return right.substr(0, common_prefix(left, right) + 1);
 }
 
 // Convert block_id into bytes.
@@ -101,49 +185,78 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
     return dbt;
 }
 
-// Convert KeyValue into bytes.
-Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
-    uint offset = 0;
+// Convert KeyValue into bytes that sort the same way.
+KeyBytes BTreeNode::marshal_key(const KeyProfile &key_profile, const KeyValue &key) {
+    KeyBytes bytes;
     uint col_num = 0;
-    for (auto const &data_type: this->key_profile) {
-        Value value = (*key)[col_num];
+    for (auto const &data_type: key_profile) {
+        const Value &value = key[col_num++];
 
         if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("index key too big to marshal");
-
-            *(int32_t *) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
+            uint32_t n = (uint32_t) value.n ^ 0x80000000U;  // so negatives sort first
+            for (int shift = 24; shift >= 0; shift -= 8)
+                bytes.push_back((char) (n >> shift));
 
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint16_t *) (bytes + offset) = (uint16_t) size;
-            offset += sizeof(uint16_t);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
+            for (char c: value.s) {  // assume ascii for now
+                bytes.push_back(c);
+                if (c == '\0')
+                    bytes.push_back((char) 0xff);
+            }
+            bytes.push_back('\0');
+            bytes.push_back('\0');
 
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
+            bytes.push_back((char) (value.n != 0));
 
         } else {
             throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
         }
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    if (bytes.size() > DbBlock::BLOCK_SZ / 4)  // so that a node always holds a few keys
+        throw DbRelationError("index key too big to marshal");
+    return bytes;
+}
+
+// Convert marshalled key back into a KeyValue. A boundary cut short by separator() comes back as the lowest key
+// that begins with it (as if the missing bytes were zeros).
+KeyValue BTreeNode::unmarshal_key(const KeyProfile &key_profile, const KeyBytes &bytes) {
+    KeyValue key_value;
+    uint offset = 0;
+    auto byte = [&bytes](uint at) { return at < bytes.size() ? bytes[at] : '\0'; };
+    for (auto const &data_type: key_profile) {
+        if (data_type == ColumnAttribute::DataType::INT) {
+            uint32_t n = 0;
+            for (uint i = 0; i < 4; i++)
+                n = n << 8 | (uint8_t) byte(offset++);
+            key_value.push_back(Value((int32_t) (n ^ 0x80000000U)));
+
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            std::string s;
+            while (byte(offset) != '\0' || byte(offset + 1) != '\0') {
+                s.push_back(byte(offset));
+                offset += byte(offset) == '\0' ? 2 : 1;  // skip the escape after a zero byte
+            }
+            offset += 2;
+            key_value.push_back(Value(s));
+
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            Value value((int32_t) byte(offset++));
+            value.data_type = ColumnAttribute::DataType::BOOLEAN;
+            key_value.push_back(value);
+
+        } else {
+            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
+        }
+    }
+    return key_value;
+}
+
+// Wrap a marshalled key in a Dbt (with its own copy of the bytes) to add to a block.
+Dbt *BTreeNode::marshal_key(const KeyBytes &key) {
+    char *bytes = new char[key.size()];
+    memcpy(bytes, key.data(), key.size());
+    return new Dbt(bytes, (u_int32_t) key.size());
 }
 
 
@@ -193,56 +306,134 @@ void BTreeStat::save() {
  *****************/
 
 BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(
-        file, block_id, key_profile, create), first(0), pointers(), boundaries() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == 1) {
-                // first pointer
-                this->first = get_block_id(i);
-            } else if (i % 2 != 0) {
-                // pointer
-                this->pointers.push_back(get_block_id(i));
-            } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
-            }
-            i++;
-        }
-        delete record_id_list;
+        file, block_id, key_profile, create), first(0), loaded(true), pointers(), boundaries() {
+    if (!create && this->block->size() > 0) {
+        // the first pointer is all we need to start with; the rest is searched where it is until we change it
+        this->first = get_block_id(1);
+        this->loaded = false;
     }
 }
 
 BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
 }
 
-// Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
+// Read in the boundaries and pointers (records 2, 4, ... and 3, 5, ...).
+void BTreeInterior::load() const {
+    if (this->loaded)
+        return;
+    uint n = this->block->size();
+    for (RecordID i = 2; i <= n; i += 2) {
+        this->boundaries.push_back(get_key(i));
+        this->pointers.push_back(get_block_id(i + 1));
     }
+    this->loaded = true;
+}
+
+void BTreeInterior::detach() {
+    load();
+    delete this->block;
+    this->block = nullptr;
+}
+
+uint BTreeInterior::child_count() const {
+    return this->loaded ? (uint) this->pointers.size() + 1 : (this->block->size() + 1U) / 2;
+}
+
+BlockID BTreeInterior::get_child(uint index) const {
+    if (index == 0)
+        return this->first;
+    return this->loaded ? this->pointers[index - 1] : get_block_id(2 * index + 1);
+}
+
+const KeyBytes &BTreeInterior::get_boundary(uint index) const {
+    load();
+    return this->boundaries[index];
+}
+
+void BTreeInterior::set_boundary(uint index, const KeyBytes &boundary) {
+    load();
+    this->boundaries[index] = boundary;
+}
+
+// Get next block down in tree where key must be.
+BTreeNode *BTreeInterior::find(const KeyBytes *key, uint depth) const {
+    BlockID down = get_child(find_index(key));
     if (depth == 2)
         return new BTreeLeaf(this->file, down, this->key_profile, false);
     else
         return new BTreeInterior(this->file, down, this->key_profile, false);
 }
 
+// Which child key must be under: the one just left of the first boundary above key (binary search).
+uint BTreeInterior::find_index(const KeyBytes *key) const {
+    if (key == nullptr)
+        return 0;
+    uint low = 0;
+    uint high = child_count() - 1;  // number of boundaries
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        int cmp = this->loaded ? compare(this->boundaries[mid], *key) : compare_key(2 * mid + 2, *key);
+        if (cmp <= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Drop a child (other than the first) along with the boundary to its left.
+void BTreeInterior::remove_child(uint index) {
+    load();
+    this->boundaries.erase(this->boundaries.begin() + index - 1);
+    this->pointers.erase(this->pointers.begin() + index - 1);
+}
+
+uint BTreeInterior::used_bytes() const {
+    load();
+    uint used = 0;
+    for (auto const &boundary: this->boundaries)
+        used += entry_size(boundary);
+    return used;
+}
+
+// The separator comes down from the parent to sit in front of the sibling's first pointer.
+void BTreeInterior::absorb(BTreeInterior &right, const KeyBytes &separator) {
+    load();
+    right.load();
+    append(separator, right.first);
+    for (uint i = 0; i < right.boundaries.size(); i++) {
+        this->boundaries.push_back(right.boundaries[i]);
+        this->pointers.push_back(right.pointers[i]);
+    }
+    right.boundaries.clear();
+    right.pointers.clear();
+}
+
+// Pool everything (with the separator in between), then split it back up where the bytes are even.
+KeyBytes BTreeInterior::balance(BTreeInterior &right, const KeyBytes &separator) {
+    absorb(right, separator);
+    uint half = used_bytes() / 2;
+    uint used = 0;
+    uint split = 0;
+    while (split < this->boundaries.size() - 1 && used + entry_size(this->boundaries[split]) < half)
+        used += entry_size(this->boundaries[split++]);
+
+    // boundary at split moves up; the pointer after it becomes the sibling's first
+    KeyBytes boundary = this->boundaries[split];
+    right.first = this->pointers[split];
+    for (uint i = split + 1; i < this->boundaries.size(); i++) {
+        right.boundaries.push_back(this->boundaries[i]);
+        right.pointers.push_back(this->pointers[i]);
+    }
+    this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
+    this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
+    return boundary;
+}
+
 // Save the pointers and boundaries in the correct order
 void BTreeInterior::save() {
     Dbt *dbt;
+    load();
     this->block->clear();
     dbt = marshal_block_id(this->first);
     this->block->add(dbt);
@@ -265,34 +456,24 @@ void BTreeInterior::save() {
 }
 
 // Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
+Insertion BTreeInterior::insert(const KeyBytes *boundary, BlockID block_id, uint append_fill) {
     // cout << "inserting (" << block_id << ", " << (*boundary)[0] << ") into interior node " << id; // DEBUG
     // cout << " (pointers:" << boundaries.size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
 
     Dbt *dbt;
+    load();
 
-    bool inserted = false;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
-            this->pointers.insert(this->pointers.begin() + i, block_id);
-            inserted = true;
-            break;
-        }
-    }
-    if (!inserted) {
-        // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
-        this->pointers.push_back(block_id);
-    }
+    // goes just before the first boundary above it (the new node is the right half of the child left of there)
+    uint i = find_index(boundary);
+    this->boundaries.insert(this->boundaries.begin() + i, *boundary);
+    this->pointers.insert(this->pointers.begin() + i, block_id);
     dbt = marshal_block_id(block_id);
     try {
         // following is just a check for size (the save method will redo this in the right order)
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
-        dbt = marshal_key(boundary);
+        dbt = marshal_key(*boundary);
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
@@ -313,16 +494,17 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
 
         // only the pointer of the middle entry goes into the sister (as it's first pointer)
         // the corresponding boundary is moved up to be inserted into the parent node
+        // (when appending, the middle is append_fill percent of the way along instead)
         u_long split = this->boundaries.size() / 2;
+        if (i + 1 == this->boundaries.size())
+            split = min(this->boundaries.size() * append_fill / 100, this->boundaries.size() - 2);
         nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
-
-        // move half of the entries to the sister
-        for (u_long i = split + 1; i < this->boundaries.size(); i++) {
-            nnode->boundaries.push_back(this->boundaries[i]);
-            nnode->pointers.push_back(this->pointers[i]);
+        Insertion ret(nnode->id, this->boundaries[split]);
+
+        // move the rest of the entries to the sister
+        for (u_long j = split + 1; j < this->boundaries.size(); j++) {
+            nnode->boundaries.push_back(this->boundaries[j]);
+            nnode->pointers.push_back(this->pointers[j]);
         }
         this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
         this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
@@ -332,18 +514,26 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
         // save everything
         nnode->save();
         this->save();
+        delete nnode;
         return ret;
     }
 }
 
+// Add a boundary at the end.
+void BTreeInterior::append(const KeyBytes &boundary, BlockID block_id) {
+    load();
+    this->boundaries.push_back(boundary);
+    this->pointers.push_back(block_id);
+}
 
 ostream &operator<<(ostream &out, const BTreeInterior &node) {
+    node.load();
     out << "(interior block " << node.id << "): " << node.first;
     if (node.boundaries.size() != node.pointers.size()) {
         out << " MISMATCH boundaries: " << node.boundaries.size() << ", pointers: " << node.pointers.size();
     } else {
         for (unsigned int i = 0; i < node.boundaries.size(); i++)
-            out << '|' << (*node.boundaries[i])[0] << '|' << node.pointers[i];
+            out << '|' << BTreeNode::unmarshal_key(node.key_profile, node.boundaries[i])[0] << '|' << node.pointers[i];
     }
     return out;
 }
@@ -358,46 +548,297 @@ BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                                key_profile,
                                                                                                                create),
                                                                                                      next_leaf(0),
-                                                                                                     key_map() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i % 2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i - 1);
-            }
-            i++;
-        }
-        delete record_id_list;
+                                                                                                     prefix(),
+                                                                                                     loaded(true),
+                                                                                                     keys(),
+                                                                                                     postings() {
+    if (!create && this->block->size() > 0) {
+        // next leaf block is the final record; the entries are searched where they are until we change them
+        this->next_leaf = get_block_id(this->block->size());
+        this->prefix = get_key(1);
+        this->loaded = false;
     }
 }
 
 BTreeLeaf::~BTreeLeaf() {
 }
 
-// Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue *key) const {
-    return this->key_map.at(*key);
+// Unmarshal the entries (record 1: prefix, record 2i + 2: posting, record 2i + 3: rest of the key).
+void BTreeLeaf::load() const {
+    if (this->loaded)
+        return;
+    uint n = entry_count();
+    this->keys.resize(n);
+    this->postings.reserve(n);
+    for (uint i = 0; i < n; i++) {
+        this->keys[i] = this->prefix + get_key(2 * i + 3);
+        this->postings.push_back(get_posting(2 * i + 2));
+    }
+    this->loaded = true;
+}
+
+uint BTreeLeaf::entry_count() const {
+    return this->loaded ? (uint) this->keys.size() : (this->block->size() - 2U) / 2;
+}
+
+// Compare the prefix with the start of key: negative or positive if every entry sorts before or after key.
+int BTreeLeaf::compare_prefix(const KeyBytes &key) const {
+    uint size = (uint) this->prefix.size();
+    if (key.size() >= size)
+        return memcmp(this->prefix.data(), key.data(), size);
+    int cmp = memcmp(this->prefix.data(), key.data(), key.size());
+    return cmp != 0 ? cmp : 1;  // key is shorter than any of ours that begin with it
 }
 
-// Save the key_map and next_leaf data in the correct order
+int BTreeLeaf::compare(uint index, const KeyBytes &key) const {
+    if (this->loaded)
+        return BTreeNode::compare(this->keys[index], key);
+    int cmp = compare_prefix(key);
+    return cmp != 0 ? cmp : compare_key(2 * index + 3, key, (uint) this->prefix.size());
+}
+
+// Binary search for the first entry whose key is not below key (or is above it, if after).
+uint BTreeLeaf::search(const KeyBytes &key, bool after) const {
+    uint low = 0;
+    uint high = entry_count();
+    if (!this->loaded && high > 0) {
+        // all or none of them sort before key unless it begins with the prefix
+        int cmp = compare_prefix(key);
+        if (cmp != 0)
+            return cmp < 0 ? high : 0;
+    }
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        int cmp = this->loaded ? BTreeNode::compare(this->keys[mid], key)
+                               : compare_key(2 * mid + 3, key, (uint) this->prefix.size());
+        if (cmp < 0 || (after && cmp == 0))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+void BTreeLeaf::read_posting(uint index, Handles &handles) const {
+    if (this->loaded)
+        read_posting(this->postings[index], handles);
+    else
+        read_posting(get_posting(2 * index + 2), handles);
+}
+
+// Find the handles for a given key
+Handles *BTreeLeaf::find_eq(const KeyBytes &key) const {
+    Handles *handles = new Handles();
+    uint i = lower_bound(key);
+    if (i < entry_count() && compare(i, key) == 0)
+        read_posting(i, *handles);
+    return handles;
+}
+
+// Remove a row from under its key.
+void BTreeLeaf::del(const KeyBytes &key, Handle handle) {
+    load();
+    uint i = lower_bound(key);
+    if (i == entry_count() || compare(i, key) != 0)
+        throw DbRelationError("key to delete is not in the index");
+    Posting &posting = this->postings[i];
+    load_posting(posting);
+    auto at = std::lower_bound(posting.handles.begin(), posting.handles.end(), handle);
+    if (at == posting.handles.end() || *at != handle)
+        throw DbRelationError("row to delete is not in the index");
+    posting.handles.erase(at);
+    if (--posting.count == 0) {
+        // any overflow blocks are abandoned
+        this->keys.erase(this->keys.begin() + i);
+        this->postings.erase(this->postings.begin() + i);
+    }
+    save();
+}
+
+void BTreeLeaf::read_posting(const Posting &posting, Handles &handles) const {
+    if (posting.loaded) {
+        handles.insert(handles.end(), posting.handles.begin(), posting.handles.end());
+        return;
+    }
+    // each overflow block has the encoded handles as record 1 and the next block id (or 0) as record 2
+    BlockID block_id = posting.overflow;
+    Dbt data;
+    while (block_id != 0) {
+        SlottedPage *page = this->file.get(block_id);
+        page->get(1, data);
+        const char *bytes = (const char *) data.get_data();
+        const char *end = bytes + data.get_size();
+        Handle prev(0, 0);
+        while (bytes < end)
+            handles.push_back(decode_handle(bytes, prev));
+        page->get(2, data);
+        block_id = *(BlockID *) data.get_data();
+        delete page;
+    }
+}
+
+// Read in an overflow list so it can be changed.
+void BTreeLeaf::load_posting(Posting &posting) const {
+    if (!posting.loaded) {
+        read_posting(posting, posting.handles);
+        posting.loaded = true;
+    }
+}
+
+// Write a loaded posting out to overflow blocks, reusing any it already has, and let go of the handles.
+void BTreeLeaf::write_overflow(Posting &posting) {
+    vector<string> chunks(1);
+    Handle prev(0, 0);
+    for (auto const &handle: posting.handles) {
+        Handle next = prev;
+        if (chunks.back().size() + encoded_size(handle, next) > OVERFLOW_ROOM) {
+            chunks.push_back(string());
+            prev = Handle(0, 0);
+        }
+        encode_handle(chunks.back(), handle, prev);
+    }
+
+    BlockPointers block_ids;
+    Dbt data;
+    for (BlockID block_id = posting.overflow; block_id != 0 && block_ids.size() < chunks.size();) {
+        block_ids.push_back(block_id);
+        SlottedPage *page = this->file.get(block_id);
+        page->get(2, data);
+        block_id = *(BlockID *) data.get_data();
+        delete page;
+    }
+    while (block_ids.size() < chunks.size()) {
+        SlottedPage *page = this->file.get_new();
+        block_ids.push_back(page->get_block_id());
+        delete page;
+    }
+
+    for (uint i = 0; i < chunks.size(); i++) {
+        SlottedPage *page = this->file.get(block_ids[i]);
+        page->clear();
+        Dbt chunk((void *) chunks[i].data(), (u_int32_t) chunks[i].size());
+        page->add(&chunk);
+        Dbt *dbt = marshal_block_id(i + 1 < chunks.size() ? block_ids[i + 1] : 0);
+        page->add(dbt);
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+        this->file.put(page);
+        delete page;
+    }
+    posting.overflow = block_ids.front();
+    posting.handles.clear();
+    posting.handles.shrink_to_fit();
+    posting.loaded = false;
+}
+
+// Convert a posting into bytes, first sending it to overflow blocks if it's too big to keep in the leaf.
+Dbt *BTreeLeaf::marshal_posting(Posting &posting) {
+    if (posting.loaded && (posting.overflow != 0 || encoded_size(posting.handles) > Posting::MAX_INLINE))
+        write_overflow(posting);
+    string bytes;
+    if (posting.loaded) {
+        put_varint(bytes, posting.count << 1);
+        Handle prev(0, 0);
+        for (auto const &handle: posting.handles)
+            encode_handle(bytes, handle, prev);
+    } else {
+        put_varint(bytes, posting.count << 1 | 1);
+        bytes.append((const char *) &posting.overflow, sizeof(BlockID));
+    }
+    char *right_size_bytes = new char[bytes.size()];
+    memcpy(right_size_bytes, bytes.data(), bytes.size());
+    return new Dbt(right_size_bytes, (u_int32_t) bytes.size());
+}
+
+// Get the record and turn it into a Posting.
+Posting BTreeLeaf::get_posting(RecordID record_id) const {
+    Dbt data;
+    this->block->get(record_id, data);
+    const char *bytes = (const char *) data.get_data();
+    const char *end = bytes + data.get_size();
+    Posting posting;
+    uint32_t header = get_varint(bytes);
+    posting.count = header >> 1;
+    if (header & 1) {
+        posting.overflow = *(BlockID *) bytes;
+        posting.loaded = false;
+    } else {
+        Handle prev(0, 0);
+        while (bytes < end)
+            posting.handles.push_back(decode_handle(bytes, prev));
+    }
+    return posting;
+}
+
+uint BTreeLeaf::used_bytes() const {
+    load();
+    uint used = 0;
+    for (uint i = 0; i < this->keys.size(); i++)
+        used += entry_size(this->keys[i], this->postings[i]);
+    return packed_size(prefix_size(), (uint) this->keys.size(), used);
+}
+
+// The keys are in order, so whatever the first and last begin with, they all do.
+uint BTreeLeaf::prefix_size() const {
+    load();
+    return this->keys.empty() ? 0 : common_prefix(this->keys.front(), this->keys.back());
+}
+
+// Take all the sibling's entries and its place in the leaf chain.
+void BTreeLeaf::absorb(BTreeLeaf &right) {
+    load();
+    right.load();
+    this->keys.insert(this->keys.end(), right.keys.begin(), right.keys.end());
+    this->postings.insert(this->postings.end(), right.postings.begin(), right.postings.end());
+    right.keys.clear();
+    right.postings.clear();
+    this->next_leaf = right.next_leaf;
+}
+
+// Pool the entries, then give the sibling everything past the split point (by bytes, less the pooled prefix,
+// which each side's prefix is at least as long as).
+KeyBytes BTreeLeaf::balance(BTreeLeaf &right, uint percent) {
+    BlockID next_leaf = this->next_leaf;
+    absorb(right);
+    this->next_leaf = next_leaf;
+    uint prefix_size = this->prefix_size();
+    uint keep = (used_bytes() - prefix_size - 4) * percent / 100;
+    uint used = 0;
+    uint split = 0;
+    while (split + 1 < this->keys.size() &&
+           used + entry_size(this->keys[split], this->postings[split]) - prefix_size < keep) {
+        used += entry_size(this->keys[split], this->postings[split]) - prefix_size;
+        split++;
+    }
+    if (split == 0 && this->keys.size() > 1)
+        split++;  // keep at least one entry on the left
+    right.keys.assign(this->keys.begin() + split, this->keys.end());
+    right.postings.assign(this->postings.begin() + split, this->postings.end());
+    this->keys.erase(this->keys.begin() + split, this->keys.end());
+    this->postings.erase(this->postings.begin() + split, this->postings.end());
+    return separator(this->keys.back(), right.keys.front());
+}
+
+// Save the prefix, the entries, and next_leaf data in the correct order
 void BTreeLeaf::save() {
     Dbt *dbt;
+    load();
     this->block->clear();
-    for (auto const &item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
+    uint prefix_size = this->prefix_size();
+    this->prefix = this->keys.empty() ? KeyBytes() : this->keys.front().substr(0, prefix_size);
+    dbt = marshal_key(this->prefix);
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    for (uint i = 0; i < this->keys.size(); i++) {
+        // posting
+        dbt = marshal_posting(this->postings[i]);
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
 
-        // key
-        dbt = marshal_key(&item.first);
+        // rest of the key
+        dbt = marshal_key(this->keys[i].substr(prefix_size));
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
@@ -409,67 +850,103 @@ void BTreeLeaf::save() {
     delete dbt;
 
     BTreeNode::save();
+
+    // go back to searching the block, so the next insert can be done in place
+    this->keys.clear();
+    this->postings.clear();
+    this->loaded = false;
 }
 
 // Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
-    // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
-    // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
-        throw DbRelationError("Duplicate keys are not allowed in unique index");
-
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+Insertion BTreeLeaf::insert(const KeyBytes &key, Handle handle, bool unique, uint append_fill) {
+    // cout << "inserting " << unmarshal_key(key_profile, key)[0] << " into leaf " << id << endl; // DEBUG
+    if (!this->loaded && insert_in_place(key, handle, unique))
+        return BTreeNode::insertion_none();
+    load();
+    uint i = lower_bound(key);
+    if (i == entry_count() || compare(i, key) != 0) {
+        this->keys.insert(this->keys.begin() + i, key);
+        this->postings.insert(this->postings.begin() + i, Posting(Handles(1, handle)));
+    } else {
+        // check unique
+        if (unique)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        Posting &posting = this->postings[i];
+        load_posting(posting);
+        auto at = std::lower_bound(posting.handles.begin(), posting.handles.end(), handle);
+        if (at != posting.handles.end() && *at == handle)
+            throw DbRelationError("row is already in the index");
+        posting.handles.insert(at, handle);
+        posting.count++;
+    }
 
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
+    if (used_bytes() <= NODE_ROOM) {
+        // no need to split
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
+    // too big, so split
+
+    // create the sister and put her to the right, then move her the upper half of the entries (by bytes), or
+    // just what's past append_fill if this is the last leaf and the new key went on its end
+    bool appending = this->next_leaf == 0 && i + 1 == this->keys.size();
+    BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+    nleaf->next_leaf = this->next_leaf;
+    this->next_leaf = nleaf->id;
+    KeyBytes boundary = balance(*nleaf, appending ? append_fill : 50);
+    cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
+    cout << " starting at value " << unmarshal_key(key_profile, nleaf->keys.front())[0] << endl; // DEBUG
+
+    nleaf->save();
+    this->save();
+    BlockID nleaf_id = nleaf->id;
+    delete nleaf;
+    return Insertion(nleaf_id, boundary);
+}
 
-        // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
-        nleaf->next_leaf = this->next_leaf;
-        this->next_leaf = nleaf->id;
-
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
-        u_long i = 0;
-        KeyValue boundary;
-        for (auto const &item: key_list) {
-            if (i < split) {
-                this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
-            } else {
-                nleaf->key_map[item.first] = item.second;
-            }
-            i++;
+// Put the handle into the block without unmarshalling the leaf: a new key that begins with the prefix gets its
+// two records inserted where they go, and a key whose posting stays in the leaf just gets that record rewritten.
+// Returns false, with nothing changed, if the leaf has to be rebuilt (or split) instead.
+bool BTreeLeaf::insert_in_place(const KeyBytes &key, Handle handle, bool unique) {
+    if (compare_prefix(key) != 0)
+        return false;
+    uint i = lower_bound(key);
+    Dbt *dbt;
+    if (i < entry_count() && compare(i, key) == 0) {
+        if (unique)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        Posting posting = get_posting(2 * i + 2);
+        if (!posting.loaded)
+            return false;
+        auto at = std::lower_bound(posting.handles.begin(), posting.handles.end(), handle);
+        if (at != posting.handles.end() && *at == handle)
+            throw DbRelationError("row is already in the index");
+        posting.handles.insert(at, handle);
+        posting.count++;
+        if (encoded_size(posting.handles) > Posting::MAX_INLINE)
+            return false;  // time for overflow blocks
+        dbt = marshal_posting(posting);
+        try {
+            this->block->put(2 * i + 2, *dbt);
+        } catch (DbBlockNoRoomError &e) {
+            delete[] (char *) dbt->get_data();
+            delete dbt;
+            return false;
         }
-        cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
-        cout << " starting at value " << boundary[0] << endl; // DEBUG
-
-        nleaf->save();
-        this->save();
-        return Insertion(nleaf->id, boundary);
+    } else {
+        Posting posting(Handles(1, handle));
+        if (this->block->unused_bytes() < entry_size(key, posting) - this->prefix.size())
+            return false;
+        dbt = marshal_posting(posting);
+        this->block->insert(2 * i + 2, dbt);
+        Dbt *suffix = marshal_key(key.substr(this->prefix.size()));
+        this->block->insert(2 * i + 3, suffix);
+        delete[] (char *) suffix->get_data();
+        delete suffix;
     }
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    BTreeNode::save();  // just marks the block dirty
+    return true;
 }
-
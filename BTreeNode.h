@@ -12,8 +12,38 @@
 typedef std::vector<ColumnAttribute::DataType> KeyProfile;
 typedef std::vector<Value> KeyValue;
 typedef std::vector<KeyValue *> KeyValues;
+typedef std::string KeyBytes;  // a KeyValue as marshalled by BTreeNode::marshal_key (these sort the same way)
+typedef std::vector<KeyBytes> KeyBytesList;
 typedef std::vector<BlockID> BlockPointers;
-typedef std::pair<BlockID, KeyValue> Insertion;
+typedef std::pair<BlockID, KeyBytes> Insertion;
+
+/**
+ * @class Posting - handles of the rows that have a given key in a BTreeLeaf, kept sorted
+ *
+ * Marshalled delta/varint encoded: each handle is its block id's distance from the one before (as a varint),
+ * then its record id (as a distance from the one before if the block is the same). Lists that still take more
+ * than MAX_INLINE bytes go out to a chain of overflow blocks, and the leaf keeps just the count and the first
+ * block; those handles aren't read in until something needs them. A list stays in overflow blocks once it's there
+ * (moving it back as it shrank could overfill the leaf on a delete).
+ */
+struct Posting {
+    static const uint MAX_INLINE = DbBlock::BLOCK_SZ / 8;
+
+    Handles handles;   // all of them, when loaded
+    BlockID overflow;  // first overflow block, or 0 if the list is kept in the leaf
+    uint count;
+    bool loaded;       // false for an overflow list that hasn't been read in (or has been written out)
+
+    Posting() : handles(), overflow(0), count(0), loaded(true) {}
+
+    explicit Posting(const Handles &handles) : handles(handles), overflow(0), count((uint) handles.size()),
+                                               loaded(true) {}
+
+    /**
+     * Bytes this posting takes up as a leaf record.
+     */
+    uint size() const;
+};
 
 class BTreeNode {
 public:
@@ -23,12 +53,43 @@ public:
 
     static bool insertion_is_none(Insertion insertion) { return insertion.first == 0; }
 
-    static Insertion insertion_none() { return Insertion(0, KeyValue()); }
+    static Insertion insertion_none() { return Insertion(0, KeyBytes()); }
+
+    static const uint NODE_ROOM = DbBlock::BLOCK_SZ - 13;  // room for records in a node after its last pointer
 
     virtual void save();
 
     BlockID get_id() const { return this->id; }
 
+    /**
+     * Marshal a key so that keys compare with memcmp the way their KeyValues compare: each INT is big-endian
+     * with its sign bit flipped, each BOOLEAN is a byte, and each TEXT has its zero bytes escaped (as 0x00 0xff)
+     * and is terminated by 0x00 0x00, so a shorter string sorts before any longer one it begins.
+     * @param key_profile  data types of the key's columns
+     * @param key          the key
+     * @returns            the marshalled key
+     */
+    static KeyBytes marshal_key(const KeyProfile &key_profile, const KeyValue &key);
+
+    static KeyValue unmarshal_key(const KeyProfile &key_profile, const KeyBytes &bytes);
+
+    // negative, zero, or positive as a sorts before, with, or after b
+    static int compare(const char *a, uint a_size, const char *b, uint b_size);
+
+    static int compare(const KeyBytes &a, const KeyBytes &b) { return compare(a.data(), (uint) a.size(), b.data(),
+                                                                              (uint) b.size()); }
+
+    static uint common_prefix(const KeyBytes &a, const KeyBytes &b);  // length of the bytes both begin with
+
+    /**
+     * Shortest boundary that sorts after left and not after right, i.e., right cut off just past where it first
+     * differs from left. It needn't be a whole key since boundaries are only compared with memcmp.
+     * @param left   highest key on the left
+     * @param right  lowest key on the right (sorts after left)
+     * @returns      the boundary
+     */
+    static KeyBytes separator(const KeyBytes &left, const KeyBytes &right);
+
 protected:
     SlottedPage *block;
     HeapFile &file;
@@ -39,13 +100,22 @@ protected:
 
     static Dbt *marshal_handle(Handle handle);
 
-    virtual Dbt *marshal_key(const KeyValue *key);
-
     virtual BlockID get_block_id(RecordID record_id) const;
 
     virtual Handle get_handle(RecordID record_id) const;
 
-    virtual KeyValue *get_key(RecordID record_id) const;
+    virtual KeyBytes get_key(RecordID record_id) const;
+
+    static Dbt *marshal_key(const KeyBytes &key);
+
+    /**
+     * Compare the key in one of our records with a key, right where it is in the block.
+     * @param record_id  record holding a marshalled key
+     * @param key        key to compare it to
+     * @param skip       leading bytes of key to leave out (ones the record doesn't store)
+     * @returns          negative, zero, or positive as the record's key sorts before, with, or after key
+     */
+    int compare_key(RecordID record_id, const KeyBytes &key, uint skip = 0) const;
 };
 
 class BTreeStat : public BTreeNode {
@@ -75,41 +145,220 @@ protected:
 
 };
 
+/**
+ * @class BTreeInterior - an interior node: the first pointer, then (boundary, pointer) pairs in sorted order
+ *
+ * Only the first pointer is read when a node is constructed. Finding a child binary-searches the boundaries
+ * right in the block, and the boundaries and pointers are only read into vectors when the node is about to be
+ * changed or they're asked for.
+ */
 class BTreeInterior : public BTreeNode {
 public:
     BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
     virtual ~BTreeInterior();
 
-    BTreeNode *find(const KeyValue *key, uint depth) const;
+    BTreeNode *find(const KeyBytes *key, uint depth) const;  // key of nullptr finds the leftmost child
+
+    // Children are numbered from 0 (the first pointer); boundary i - 1 is the lowest key under child i.
+    uint find_index(const KeyBytes *key) const;
+
+    uint child_count() const;
 
-    Insertion insert(const KeyValue *boundary, BlockID block_id);
+    BlockID get_child(uint index) const;
+
+    const KeyBytes &get_boundary(uint index) const;
+
+    void set_boundary(uint index, const KeyBytes &boundary);
+
+    void remove_child(uint index);
+
+    /**
+     * Bytes of records this node's boundaries and pointers take up in its block (not counting the first pointer).
+     */
+    uint used_bytes() const;
+
+    static uint entry_size(const KeyBytes &boundary) { return (uint) boundary.size() + 4 + sizeof(BlockID) + 4; }
+
+    /**
+     * Merge the right sibling into this node (the caller saves this node and drops the sibling from the parent).
+     * @param right      right sibling
+     * @param separator  parent's boundary between us
+     */
+    void absorb(BTreeInterior &right, const KeyBytes &separator);
+
+    /**
+     * Even out the bytes in this node and its right sibling (the caller saves both).
+     * @param right      right sibling
+     * @param separator  parent's boundary between us
+     * @returns          the new boundary for the parent
+     */
+    KeyBytes balance(BTreeInterior &right, const KeyBytes &separator);
+
+    /**
+     * Add a pointer to a new child, splitting if the node no longer fits in its block.
+     * @param boundary     lowest key under the new child
+     * @param block_id     new child
+     * @param append_fill  percent of the boundaries to keep here if the new one is the last and we split
+     * @returns            the new sibling and the boundary for the parent if there was a split
+     */
+    Insertion insert(const KeyBytes *boundary, BlockID block_id, uint append_fill = 50);
 
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
 
+    /**
+     * Unmarshal everything and let go of the block. The node can still be searched but not changed or saved.
+     */
+    void detach();
+
+    /**
+     * Add a boundary that sorts after all the others (for bulk loading; the caller checks the size and saves).
+     * @param boundary  lowest key in the subtree
+     * @param block_id  subtree's root
+     */
+    void append(const KeyBytes &boundary, BlockID block_id);
+
     friend std::ostream &operator<<(std::ostream &out, const BTreeInterior &node);
 
 protected:
     BlockID first;
-    BlockPointers pointers;
-    KeyValues boundaries;
+    mutable bool loaded;  // whether pointers and boundaries have been unmarshalled from the block yet
+    mutable BlockPointers pointers;
+    mutable KeyBytesList boundaries;
+
+    void load() const;
 };
 
+/**
+ * @class BTreeLeaf - a leaf node: the prefix, (posting, key) pairs in sorted key order, then the next leaf's block id
+ *
+ * Entries are numbered from 0 in key order. Like BTreeInterior, a leaf is searched in its block and only
+ * unmarshalled (into parallel sorted vectors of keys and postings) when it's about to be changed. Keys stay
+ * marshalled either way. The bytes all the keys in the block begin with are stored once, as the prefix, and
+ * each key record holds just the rest of its key.
+ */
 class BTreeLeaf : public BTreeNode {
 public:
     BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue *key) const;  // throws if not found
-    Insertion insert(const KeyValue *key, Handle handle);
+    Handles *find_eq(const KeyBytes &key) const;  // empty if not found
+
+    /**
+     * Add a row's handle under its key, splitting if the leaf no longer fits in its block. Usually the entry
+     * is just slotted into the block where it goes; the leaf is only rebuilt when the prefix changes, a posting
+     * goes to overflow blocks, or the block is full.
+     * @param key          key value
+     * @param handle       row it belongs to
+     * @param unique       whether to refuse a key that is already here
+     * @param append_fill  percent of the bytes to keep here if this is the last leaf, key goes on its end,
+     *                     and we split (so sequential keys leave full leaves behind them)
+     * @returns            the new sibling and its boundary if there was a split
+     */
+    Insertion insert(const KeyBytes &key, Handle handle, bool unique, uint append_fill = 50);
+
+    /**
+     * Add an entry whose key sorts after all the others (for bulk loading; the caller checks the size and saves).
+     * @param key      key value
+     * @param posting  rows it belongs to
+     */
+    void append(const KeyBytes &key, const Posting &posting) {
+        load();
+        this->keys.push_back(key);
+        this->postings.push_back(posting);
+    }
+
+    void set_next_leaf(BlockID next_leaf) { this->next_leaf = next_leaf; }
+
+    BlockID get_next_leaf() const { return this->next_leaf; }
+
+    /**
+     * Remove a row's handle from under its key (and the key too if that was its last row) and save.
+     * @param key     key value
+     * @param handle  row to remove
+     * @throws        DbRelationError if the row isn't in this leaf
+     */
+    void del(const KeyBytes &key, Handle handle);
+
+    uint entry_count() const;
+
+    uint lower_bound(const KeyBytes &key) const { return search(key, false); }  // first entry not below key
+
+    uint upper_bound(const KeyBytes &key) const { return search(key, true); }  // first entry above key
+
+    int compare(uint index, const KeyBytes &key) const;  // an entry's key vs. key, as in compare_key
+
+    /**
+     * Get all the handles of an entry's posting, reading its overflow blocks if need be.
+     * @param index    which entry
+     * @param handles  the handles are appended here
+     */
+    void read_posting(uint index, Handles &handles) const;
+
+    /**
+     * Bytes of records this leaf's prefix and entries take up in its block (not counting the next_leaf pointer).
+     */
+    uint used_bytes() const;
+
+    static uint entry_size(const KeyBytes &key, const Posting &posting) {
+        return posting.size() + 4 + (uint) key.size() + 4;
+    }
+
+    /**
+     * Bytes a leaf's records take up once the prefix is taken off its keys.
+     * @param prefix_size  bytes all the keys begin with
+     * @param count        number of entries
+     * @param entry_bytes  total entry_size of the entries
+     */
+    static uint packed_size(uint prefix_size, uint count, uint entry_bytes) {
+        return prefix_size + 4 + entry_bytes - count * prefix_size;
+    }
+
+    /**
+     * Merge the right sibling into this leaf (the caller saves this leaf and drops the sibling from the parent).
+     * @param right  right sibling
+     */
+    void absorb(BTreeLeaf &right);
+
+    /**
+     * Even out the bytes in this leaf and its right sibling (the caller saves both).
+     * @param right    right sibling
+     * @param percent  share of the bytes to leave in this leaf
+     * @returns        the new boundary for the parent (see separator)
+     */
+    KeyBytes balance(BTreeLeaf &right, uint percent = 50);
 
     virtual void save();
 
 protected:
+    static const uint OVERFLOW_ROOM = DbBlock::BLOCK_SZ - 17;  // room for handles in an overflow block
     BlockID next_leaf;
-    std::map<KeyValue, Handle> key_map;
+    KeyBytes prefix;  // as last saved
+    mutable bool loaded;  // whether the entries have been unmarshalled from the block yet
+    mutable KeyBytesList keys;
+    mutable std::vector<Posting> postings;  // postings[i] goes with keys[i]
+
+    void load() const;
+
+    uint search(const KeyBytes &key, bool after) const;
+
+    int compare_prefix(const KeyBytes &key) const;
+
+    bool insert_in_place(const KeyBytes &key, Handle handle, bool unique);
+
+    uint prefix_size() const;  // of the keys as they are now
+
+    Dbt *marshal_posting(Posting &posting);
+
+    Posting get_posting(RecordID record_id) const;
+
+    void read_posting(const Posting &posting, Handles &handles) const;
+
+    void load_posting(Posting &posting) const;
+
+    void write_overflow(Posting &posting);
 };
 
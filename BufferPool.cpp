@@ -0,0 +1,245 @@
+/**
+ * @file BufferPool.cpp - implementation of the BufferPool buffer manager
+ * @author Marwa, Ramya
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <cstring>
+#include "BufferPool.h"
+#include "HeapFile.h"
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param num_frames  fixed number of block-sized frames to manage
+ */
+BufferPool::BufferPool(uint num_frames) : num_frames(num_frames), frames(nullptr), hand(0), resident(), hits(0),
+                                          misses(0), evictions(0), writes(0) {
+    if (num_frames == 0)
+        throw DbRelationError("buffer pool needs at least one frame");
+    this->frames = new BufferFrame[num_frames];
+    for (uint i = 0; i < num_frames; i++)
+        this->frames[i].pool = this;
+    this->resident.reserve(num_frames);
+}
+
+BufferPool::~BufferPool() {
+    delete[] this->frames;
+}
+
+/**
+ * Get a pinned frame for the given block, reading it in if necessary.
+ * @param file      file the block belongs to
+ * @param block_id  which block
+ * @return          the pinned frame
+ */
+BufferFrame *BufferPool::pin(HeapFile *file, BlockID block_id) {
+    auto it = this->resident.find(FrameKey(file, block_id));
+    if (it != this->resident.end()) {
+        this->hits++;
+        BufferFrame *frame = it->second;
+        frame->pin_count++;
+        frame->referenced = true;
+        return frame;
+    }
+
+    this->misses++;
+    BufferFrame *frame = victim();
+    file->read_block(block_id, frame->data);
+    frame->file = file;
+    frame->block_id = block_id;
+    frame->pin_count = 1;
+    frame->dirty = false;
+    frame->referenced = true;
+    this->resident[FrameKey(file, block_id)] = frame;
+    return frame;
+}
+
+/**
+ * Get a pinned, zero-filled frame for a newly allocated block.
+ * @param file      file the block belongs to
+ * @param block_id  id of the new block
+ * @return          the pinned frame
+ */
+BufferFrame *BufferPool::pin_new(HeapFile *file, BlockID block_id) {
+    BufferFrame *frame;
+    auto it = this->resident.find(FrameKey(file, block_id));
+    if (it != this->resident.end()) {
+        frame = it->second;  // stale copy of a block id being reused
+        frame->pin_count++;
+    } else {
+        frame = victim();
+        frame->file = file;
+        frame->block_id = block_id;
+        frame->pin_count = 1;
+        this->resident[FrameKey(file, block_id)] = frame;
+    }
+    memset(frame->data, 0, sizeof(frame->data));
+    frame->dirty = true;
+    frame->referenced = true;
+    return frame;
+}
+
+/**
+ * Add a pin to an already pinned frame.
+ * @param frame
+ */
+void BufferPool::pin(BufferFrame *frame) {
+    frame->pin_count++;
+}
+
+/**
+ * Release a pin.
+ * @param frame
+ */
+void BufferPool::unpin(BufferFrame *frame) {
+    if (frame->pin_count == 0)
+        throw DbRelationError("unpin of a frame that is not pinned");
+    frame->pin_count--;
+}
+
+/**
+ * Mark a block as changed (or write it through if it isn't resident).
+ * @param file      file the block belongs to
+ * @param block_id  which block
+ * @param data      new contents of the block
+ */
+void BufferPool::write(HeapFile *file, BlockID block_id, const void *data) {
+    auto it = this->resident.find(FrameKey(file, block_id));
+    if (it == this->resident.end()) {
+        this->writes++;
+        file->write_block(block_id, data);
+        return;
+    }
+    BufferFrame *frame = it->second;
+    if (frame->data != data)
+        memcpy(frame->data, data, sizeof(frame->data));
+    frame->dirty = true;
+    frame->referenced = true;
+}
+
+/**
+ * Write back the dirty frames of a file.
+ * @param file
+ */
+void BufferPool::flush(HeapFile *file) {
+    for (uint i = 0; i < this->num_frames; i++)
+        if (this->frames[i].file == file && this->frames[i].dirty)
+            write_back(&this->frames[i]);
+}
+
+/**
+ * Drop all the frames of a file on the floor.
+ * @param file
+ */
+void BufferPool::discard(HeapFile *file) {
+    for (uint i = 0; i < this->num_frames; i++) {
+        BufferFrame &frame = this->frames[i];
+        if (frame.file == file) {
+            this->resident.erase(FrameKey(file, frame.block_id));
+            frame.file = nullptr;
+            frame.block_id = 0;
+            frame.dirty = false;
+            frame.referenced = false;
+        }
+    }
+}
+
+/**
+ * Write back every dirty frame.
+ */
+void BufferPool::flush_all() {
+    for (uint i = 0; i < this->num_frames; i++)
+        if (this->frames[i].file != nullptr && this->frames[i].dirty)
+            write_back(&this->frames[i]);
+}
+
+/**
+ * Choose a frame to reuse with the CLOCK algorithm: sweep around the frames skipping pinned ones and
+ * giving referenced ones a second chance. The chosen frame is written back if dirty and unmapped.
+ * @return  an unpinned, unmapped frame
+ * @throws  DbRelationError if every frame is pinned
+ */
+BufferFrame *BufferPool::victim() {
+    for (uint tries = 0; tries < 2 * this->num_frames; tries++) {
+        BufferFrame *frame = &this->frames[this->hand];
+        this->hand = (this->hand + 1) % this->num_frames;
+        if (frame->pin_count > 0)
+            continue;
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        if (frame->file != nullptr) {
+            this->evictions++;
+            if (frame->dirty)
+                write_back(frame);
+            this->resident.erase(FrameKey(frame->file, frame->block_id));
+            frame->file = nullptr;
+        }
+        return frame;
+    }
+    throw DbRelationError("buffer pool exhausted: all frames are pinned");
+}
+
+/**
+ * Write a frame's contents to its file and mark it clean.
+ * @param frame
+ */
+void BufferPool::write_back(BufferFrame *frame) {
+    this->writes++;
+    frame->file->write_block(frame->block_id, frame->data);
+    frame->dirty = false;
+}
+
+/**
+ * Testing function for BufferPool.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_buffer_pool() {
+    HeapFile file("_test_buffer_pool");
+    file.create();
+    for (int i = 0; i < 5; i++)
+        delete file.get_new();  // blocks 2 through 6
+    _BUFFER_POOL->flush(&file);
+
+    // a resident block comes back from the same frame without going to Berkeley DB
+    u_long hits = _BUFFER_POOL->get_hits();
+    SlottedPage *page = file.get(1);
+    SlottedPage *again = file.get(1);
+    bool same_frame = page->get_data() == again->get_data();
+    delete page;
+    delete again;
+    if (!same_frame || _BUFFER_POOL->get_hits() != hits + 2)
+        return assertion_failure("get of resident block missed the pool");
+
+    // CLOCK eviction and write-back, using a tiny pool of our own
+    const char *message = "buffer pool";
+    BufferPool pool(3);
+    BufferFrame *frame = pool.pin(&file, 2);
+    strcpy(frame->get_data() + 100, message);
+    pool.write(&file, 2, frame->get_data());
+    pool.unpin(frame);
+    for (BlockID block_id = 3; block_id <= 6; block_id++)
+        pool.unpin(pool.pin(&file, block_id));
+    if (pool.get_evictions() == 0 || pool.get_writes() != 1)
+        return assertion_failure("eviction with write-back", pool.get_evictions(), pool.get_writes());
+    frame = pool.pin(&file, 2);
+    if (strcmp(frame->get_data() + 100, message) != 0)
+        return assertion_failure("dirty block lost on eviction");
+
+    // can't evict pinned frames
+    BufferFrame *frame3 = pool.pin(&file, 3);
+    BufferFrame *frame4 = pool.pin(&file, 4);
+    try {
+        pool.pin(&file, 5);
+        return assertion_failure("failed to throw when all frames pinned");
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    pool.unpin(frame);
+    pool.unpin(frame3);
+    pool.unpin(frame4);
+    file.drop();
+    return true;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file BufferPool.h - Buffer manager sitting between the HeapFiles and Berkeley DB.
+ * BufferFrame
+ * BufferPool
+ *
+ * @author Marwa, Ramya
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include "storage_engine.h"
+
+class HeapFile;
+class BufferPool;
+
+/**
+ * @class BufferFrame - one block-sized slot of memory in the BufferPool
+ *
+ * A frame holds a copy of one block of one HeapFile. While a frame is pinned it will not be
+ * evicted, so DbBlocks built on top of its memory stay valid until they unpin it.
+ */
+class BufferFrame {
+public:
+    BufferFrame() : pool(nullptr), file(nullptr), block_id(0), pin_count(0), dirty(false), referenced(false) {}
+
+    BufferFrame(const BufferFrame &other) = delete;
+
+    BufferFrame &operator=(const BufferFrame &other) = delete;
+
+    /**
+     * Access the frame's memory (always DbBlock::BLOCK_SZ bytes).
+     * @returns  raw bytes of the block held in this frame
+     */
+    char *get_data() { return data; }
+
+    BufferPool *get_pool() const { return pool; }
+
+    BlockID get_block_id() const { return block_id; }
+
+protected:
+    BufferPool *pool;
+    HeapFile *file;  // nullptr if the frame is free (or was discarded while still pinned)
+    BlockID block_id;
+    uint pin_count;
+    bool dirty;
+    bool referenced;  // CLOCK reference bit
+    char data[DbBlock::BLOCK_SZ];
+
+    friend class BufferPool;
+};
+
+
+/**
+ * @class BufferPool - fixed-size array of BufferFrames with pinning and CLOCK eviction
+ *
+ * HeapFile::get() asks the pool for a pinned frame; if the block is resident this is just a hash
+ * lookup, otherwise a victim frame is chosen by the CLOCK algorithm (written back first if dirty)
+ * and the block is read from Berkeley DB into it. HeapFile::put() only marks the frame dirty; dirty
+ * frames are written back when evicted or when their file is flushed or closed.
+ */
+class BufferPool {
+public:
+    /**
+     * Number of frames used by default (4MB worth of blocks).
+     */
+    static const uint DEFAULT_FRAMES = 1024;
+
+    explicit BufferPool(uint num_frames = DEFAULT_FRAMES);
+
+    virtual ~BufferPool();
+
+    BufferPool(const BufferPool &other) = delete;
+
+    BufferPool(BufferPool &&temp) = delete;
+
+    BufferPool &operator=(const BufferPool &other) = delete;
+
+    BufferPool &operator=(BufferPool &&temp) = delete;
+
+    /**
+     * Get a pinned frame holding the given block, reading it from the file if not resident.
+     * @param file      file the block belongs to
+     * @param block_id  which block
+     * @returns         pinned frame (release with unpin)
+     * @throws          DbRelationError if every frame is pinned
+     */
+    BufferFrame *pin(HeapFile *file, BlockID block_id);
+
+    /**
+     * Get a pinned, zeroed frame for a block that has just been allocated (nothing is read).
+     * The frame starts out dirty so the new block reaches the file eventually.
+     * @param file      file the block belongs to
+     * @param block_id  id of the new block
+     * @returns         pinned frame (release with unpin)
+     */
+    BufferFrame *pin_new(HeapFile *file, BlockID block_id);
+
+    /**
+     * Add another pin to a frame that is already pinned (e.g., when a block object is copied).
+     * @param frame  frame to pin again
+     */
+    void pin(BufferFrame *frame);
+
+    /**
+     * Release one pin on a frame. Unpinned frames become candidates for eviction.
+     * @param frame  frame to unpin
+     */
+    void unpin(BufferFrame *frame);
+
+    /**
+     * Record that a block has been changed. If the block is resident, the frame is updated and marked
+     * dirty; otherwise the bytes are written straight through to the file.
+     * @param file      file the block belongs to
+     * @param block_id  which block
+     * @param data      the block's new contents (DbBlock::BLOCK_SZ bytes)
+     */
+    void write(HeapFile *file, BlockID block_id, const void *data);
+
+    /**
+     * Write back all the dirty frames belonging to a file.
+     * @param file  file to flush
+     */
+    void flush(HeapFile *file);
+
+    /**
+     * Forget every frame belonging to a file without writing anything back (e.g., when it is dropped
+     * or closed). Frames that are still pinned are detached from the file and freed when unpinned.
+     * @param file  file whose frames to throw away
+     */
+    void discard(HeapFile *file);
+
+    /**
+     * Write back every dirty frame in the pool.
+     */
+    void flush_all();
+
+    // statistics
+    u_long get_hits() const { return hits; }
+
+    u_long get_misses() const { return misses; }
+
+    u_long get_evictions() const { return evictions; }
+
+    u_long get_writes() const { return writes; }
+
+protected:
+    typedef std::pair<const HeapFile *, BlockID> FrameKey;
+
+    struct FrameKeyHash {
+        size_t operator()(const FrameKey &key) const {
+            return std::hash<const HeapFile *>()(key.first) ^ (std::hash<BlockID>()(key.second) * 31U);
+        }
+    };
+
+    uint num_frames;
+    BufferFrame *frames;
+    uint hand;  // CLOCK hand
+    std::unordered_map<FrameKey, BufferFrame *, FrameKeyHash> resident;
+    u_long hits, misses, evictions, writes;
+
+    BufferFrame *victim();
+
+    void write_back(BufferFrame *frame);
+};
+
+/**
+ * Global buffer pool shared by all the HeapFiles (allocated along with _DB_ENV).
+ */
+extern BufferPool *_BUFFER_POOL;
+
+bool test_buffer_pool();
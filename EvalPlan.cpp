@@ -4,7 +4,13 @@
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <unordered_map>
 #include "EvalPlan.h"
+#include "RowBatch.h"
+#include "btree.h"
 
 
 class Dummy : public DbRelation {
@@ -43,24 +49,865 @@ public:
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) { return nullptr; }
 };
 
+/**
+ * Scan of a relation (optionally restricted by a where clause pushed into the relation's cursor),
+ * projecting either all the columns or just the given ones.
+ */
+class ScanOperator : public EvalOperator {
+public:
+    ScanOperator(DbRelation &table, const Disjunction *where, const ColumnNames *column_names) : table(table),
+                                                                                               where(where),
+                                                                                               column_names(
+                                                                                                       column_names),
+                                                                                               cursor(nullptr) {}
+
+    virtual ~ScanOperator() { close(); }
+
+    virtual void open() {
+        close();
+        cursor = table.cursor(where);
+    }
+
+    virtual ValueDict *next() {
+        Handle handle;
+        if (cursor == nullptr || !cursor->next(handle))
+            return nullptr;
+        if (column_names == nullptr)
+            return table.project(handle);
+        return table.project(handle, column_names);
+    }
+
+    virtual void close() {
+        delete cursor;
+        cursor = nullptr;
+    }
+
+protected:
+    DbRelation &table;
+    const Disjunction *where;
+    const ColumnNames *column_names;
+    HandleCursor *cursor;
+};
+
+/**
+ * Vectorized version of ScanOperator: pulls RowBatches from the relation's batch cursor, narrows each
+ * batch's selection with the where clause one column at a time, and only builds rows for the survivors.
+ */
+class BatchScanOperator : public EvalOperator {
+public:
+    BatchScanOperator(DbRelation &table, const Disjunction *where, const ColumnNames *column_names)
+            : table(table), where(where), column_names(column_names), batch_columns(), batch(nullptr),
+              cursor(nullptr), position(0) {}
+
+    virtual ~BatchScanOperator() {
+        close();
+        delete batch;
+    }
+
+    virtual void open() {
+        close();
+        if (batch == nullptr) {
+            // decode the output columns plus whatever the where clause needs, each just once (get_row copies a
+            // column the projection repeats from its one slot)
+            ColumnNames wanted = column_names == nullptr ? table.get_column_names() : *column_names;
+            if (where != nullptr)
+                for (auto const &conjunction: *where)
+                    for (auto const &predicate: conjunction)
+                        wanted.push_back(predicate.column_name);
+            batch_columns.clear();
+            for (auto const &column_name: wanted)
+                if (std::find(batch_columns.begin(), batch_columns.end(), column_name) == batch_columns.end())
+                    batch_columns.push_back(column_name);
+            ColumnAttributes *column_attributes = table.get_column_attributes(batch_columns);
+            batch = new RowBatch(batch_columns, *column_attributes);
+            delete column_attributes;
+        }
+        batch->clear();
+        position = 0;
+        cursor = table.batch_cursor(&batch_columns);
+    }
+
+    virtual ValueDict *next() {
+        if (cursor == nullptr)
+            return nullptr;
+        while (position >= batch->get_selection().size()) {
+            if (!cursor->next(*batch))
+                return nullptr;
+            batch->select_all();
+            batch->filter(where);
+            position = 0;
+        }
+        return batch->get_row(batch->get_selection()[position++], column_names);
+    }
+
+    virtual void close() {
+        delete cursor;
+        cursor = nullptr;
+    }
+
+protected:
+    DbRelation &table;
+    const Disjunction *where;
+    const ColumnNames *column_names;
+    ColumnNames batch_columns;
+    RowBatch *batch;
+    BatchCursor *cursor;
+    uint position;
+};
+
+/**
+ * Whether a row has every column of one of the conjunctions and its values match them.
+ */
+static bool row_matches(const ValueDict *row, const Disjunction &where) {
+    for (auto const &conjunction: where) {
+        bool all = true;
+        for (auto const &predicate: conjunction) {
+            auto column = row->find(predicate.column_name);
+            if (column == row->end() || !predicate.matches(column->second)) {
+                all = false;
+                break;
+            }
+        }
+        if (all)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Put a row of each side of a join together: every column as <table>.<column>, and also as plain <column> if the
+ * other side doesn't have one by that name.
+ */
+static ValueDict *join_row(const DbRelation &left_table, const ValueDict &left_row, const DbRelation &right_table,
+                           const ValueDict &right_row) {
+    ValueDict *row = new ValueDict();
+    for (auto const &column: left_row) {
+        (*row)[left_table.get_table_name() + "." + column.first] = column.second;
+        if (right_row.find(column.first) == right_row.end())
+            (*row)[column.first] = column.second;
+    }
+    for (auto const &column: right_row) {
+        (*row)[right_table.get_table_name() + "." + column.first] = column.second;
+        if (left_row.find(column.first) == left_row.end())
+            (*row)[column.first] = column.second;
+    }
+    return row;
+}
+
+/**
+ * Pass through only the rows from the child that match one of the conjunctions.
+ */
+class FilterOperator : public EvalOperator {
+public:
+    FilterOperator(EvalOperator *child, const Disjunction *where) : child(child), where(where) {}
+
+    virtual ~FilterOperator() { delete child; }
+
+    virtual void open() { child->open(); }
+
+    virtual ValueDict *next() {
+        ValueDict *row;
+        while ((row = child->next()) != nullptr) {
+            if (matches(row))
+                return row;
+            delete row;
+        }
+        return nullptr;
+    }
+
+    virtual void close() { child->close(); }
+
+protected:
+    EvalOperator *child;
+    const Disjunction *where;
+
+    bool matches(const ValueDict *row) const { return row_matches(row, *where); }
+};
+
+/**
+ * Look up the rows with the given key in an index, projecting either all the columns or just the given ones.
+ */
+class IndexScanOperator : public EvalOperator {
+public:
+    IndexScanOperator(DbIndex &index, const ValueDict *key, const ColumnNames *column_names) : index(index),
+                                                                                              key(key),
+                                                                                              column_names(
+                                                                                                      column_names),
+                                                                                              handles(nullptr),
+                                                                                              position(0) {}
+
+    virtual ~IndexScanOperator() { close(); }
+
+    virtual void open() {
+        close();
+        index.open();
+        handles = index.lookup((ValueDict *) key);
+        position = 0;
+    }
+
+    virtual ValueDict *next() {
+        if (handles == nullptr || position >= handles->size())
+            return nullptr;
+        Handle handle = (*handles)[position++];
+        if (column_names == nullptr)
+            return index.get_relation().project(handle);
+        return index.get_relation().project(handle, column_names);
+    }
+
+    virtual void close() {
+        delete handles;
+        handles = nullptr;
+    }
+
+protected:
+    DbIndex &index;
+    const ValueDict *key;
+    const ColumnNames *column_names;
+    Handles *handles;
+    uint position;
+};
+
+/**
+ * Walk a key range of an index, projecting either all the columns or just the given ones.
+ */
+class IndexRangeOperator : public EvalOperator {
+public:
+    IndexRangeOperator(DbIndex &index, const ValueDict *min_key, bool min_inclusive, const ValueDict *max_key,
+                       bool max_inclusive, const ColumnNames *column_names) : index(index), min_key(min_key),
+                                                                              min_inclusive(min_inclusive),
+                                                                              max_key(max_key),
+                                                                              max_inclusive(max_inclusive),
+                                                                              column_names(column_names),
+                                                                              cursor(nullptr) {}
+
+    virtual ~IndexRangeOperator() { close(); }
+
+    virtual void open() {
+        close();
+        index.open();
+        cursor = index.range_cursor(min_key, max_key, min_inclusive, max_inclusive);
+    }
+
+    virtual ValueDict *next() {
+        Handle handle;
+        if (cursor == nullptr || !cursor->next(handle))
+            return nullptr;
+        if (column_names == nullptr)
+            return index.get_relation().project(handle);
+        return index.get_relation().project(handle, column_names);
+    }
+
+    virtual void close() {
+        delete cursor;
+        cursor = nullptr;
+    }
+
+protected:
+    DbIndex &index;
+    const ValueDict *min_key;
+    bool min_inclusive;
+    const ValueDict *max_key;
+    bool max_inclusive;
+    const ColumnNames *column_names;
+    HandleCursor *cursor;
+};
+
+/**
+ * Get the handles from a plan's pipeline (e.g., a Union of index lookups), projecting either all the columns or just
+ * the given ones.
+ */
+class PipelineOperator : public EvalOperator {
+public:
+    PipelineOperator(EvalPlan &plan, const ColumnNames *column_names) : plan(plan), column_names(column_names),
+                                                                       pipeline(nullptr, nullptr), position(0) {}
+
+    virtual ~PipelineOperator() { close(); }
+
+    virtual void open() {
+        close();
+        pipeline = plan.pipeline();
+        position = 0;
+    }
+
+    virtual ValueDict *next() {
+        Handles *handles = pipeline.second;
+        if (handles == nullptr || position >= handles->size())
+            return nullptr;
+        Handle handle = (*handles)[position++];
+        if (column_names == nullptr)
+            return pipeline.first->project(handle);
+        return pipeline.first->project(handle, column_names);
+    }
+
+    virtual void close() {
+        delete pipeline.second;
+        pipeline.second = nullptr;
+    }
+
+protected:
+    EvalPlan &plan;
+    const ColumnNames *column_names;
+    EvalPipeline pipeline;
+    uint position;
+};
+
+/**
+ * Join the rows of two plans where the left key columns equal the right ones, by hashing. Only the build side is
+ * read up front, as handles from its pipeline(): its rows go into a hash table, and the probe side's rows stream
+ * past it from the probe plan's own operator, one at a time. The build side is the left one, unless the left side
+ * is a bare table scan and the right one isn't (the filtered side is likely the smaller one).
+ *
+ * When the build side has more than EvalPlan::join_memory rows, its handles are split by the hash of their keys
+ * into temporary files (reading just the key columns), and so are the probe rows as they stream in. Then each pair
+ * of partitions is joined in turn, so only about a partition's worth of build rows is held at once. Joined rows
+ * are named as in join_row.
+ */
+class HashJoinOperator : public EvalOperator {
+public:
+    HashJoinOperator(EvalPlan &left, EvalPlan &right, const ColumnNames &left_keys, const ColumnNames &right_keys)
+            : left(left), right(right), left_keys(left_keys), right_keys(right_keys), build_is_left(true),
+              build_table(nullptr), probe_table(nullptr), probe(nullptr), build_files(), probe_files(),
+              partitions(0), partition(0), hash_table(), probe_row(nullptr), matches(), match(0) {}
+
+    virtual ~HashJoinOperator() { close(); }
+
+    virtual void open() {
+        close();
+        build_is_left = !(left.get_type() == EvalPlan::TableScan && right.get_type() != EvalPlan::TableScan);
+        EvalPlan &build_plan = build_is_left ? left : right;
+        EvalPlan &probe_plan = build_is_left ? right : left;
+        probe_table = probe_plan.base_table();
+        if (probe_table == nullptr)
+            throw DbRelationError("can only join the rows of one table with those of another");
+        EvalPipeline build = build_plan.pipeline();
+        build_table = build.first;
+        u_long memory = std::max(EvalPlan::join_memory, (u_long) 1);
+        try {
+            probe = probe_plan.compile();
+            if (build.second->size() <= memory) {
+                partitions = 1;
+                build_hash_table(*build.second);
+                probe->open();
+            } else {
+                partitions = (uint) (2 * ((build.second->size() + memory - 1) / memory));
+                spill_build(*build.second);
+                spill_probe();
+                load_partition();
+            }
+        } catch (...) {
+            delete build.second;
+            throw;
+        }
+        delete build.second;
+    }
+
+    virtual ValueDict *next() {
+        while (true) {
+            if (match < matches.size()) {
+                const ValueDict *build_row = matches[match++];
+                if (build_is_left)
+                    return join_row(*build_table, *build_row, *probe_table, *probe_row);
+                return join_row(*probe_table, *probe_row, *build_table, *build_row);
+            }
+            delete probe_row;
+            probe_row = nullptr;
+            if (probe == nullptr)
+                return nullptr;
+            probe_row = probe_files.empty() ? probe->next() : read_row(probe_files[partition]);
+            if (probe_row == nullptr) {
+                if (partition + 1 >= partitions)
+                    return nullptr;
+                partition++;
+                load_partition();
+                continue;
+            }
+            find_matches();
+        }
+    }
+
+    virtual void close() {
+        clear_hash_table();
+        delete probe_row;
+        probe_row = nullptr;
+        if (probe != nullptr) {
+            probe->close();
+            delete probe;
+            probe = nullptr;
+        }
+        for (auto file: build_files)
+            std::fclose(file);
+        build_files.clear();
+        for (auto file: probe_files)
+            std::fclose(file);
+        probe_files.clear();
+        partitions = partition = 0;
+    }
+
+protected:
+    typedef std::unordered_multimap<size_t, ValueDict *> HashTable;
+
+    EvalPlan &left;
+    EvalPlan &right;
+    const ColumnNames &left_keys;
+    const ColumnNames &right_keys;
+    bool build_is_left;  // whether the left side is the one in the hash table
+    DbRelation *build_table;
+    const DbRelation *probe_table;
+    EvalOperator *probe;  // streams the probe side's rows
+    std::vector<std::FILE *> build_files;  // a temporary file of handles for each partition (if spilled)
+    std::vector<std::FILE *> probe_files;  // a temporary file of rows for each partition (if spilled)
+    uint partitions;
+    uint partition;  // the one being joined
+    HashTable hash_table;  // build rows of the partition, by the hash of their keys
+    ValueDict *probe_row;
+    std::vector<const ValueDict *> matches;  // build rows that join with probe_row
+    uint match;  // next one of them
+
+    const ColumnNames &build_keys() const { return build_is_left ? left_keys : right_keys; }
+
+    const ColumnNames &probe_keys() const { return build_is_left ? right_keys : left_keys; }
+
+    static size_t hash(const ValueDict &row, const ColumnNames &keys) {
+        size_t h = 0;
+        for (auto const &column_name: keys) {
+            auto column = row.find(column_name);
+            if (column == row.end())
+                throw DbRelationError("unknown column " + column_name);
+            const Value &value = column->second;
+            if (value.data_type == ColumnAttribute::TEXT)
+                h = h * 31 + std::hash<std::string>()(value.s);
+            else
+                h = h * 31 + std::hash<int32_t>()(value.n);
+        }
+        return h;
+    }
+
+    void build_hash_table(const Handles &handles) {
+        const ColumnNames &keys = build_keys();
+        for (auto const &handle: handles) {
+            ValueDict *row = build_table->project(handle);
+            hash_table.insert(HashTable::value_type(hash(*row, keys), row));
+        }
+    }
+
+    void clear_hash_table() {
+        for (auto const &entry: hash_table)
+            delete entry.second;
+        hash_table.clear();
+        matches.clear();
+        match = 0;
+    }
+
+    // Gather the build rows whose keys equal the probe row's.
+    void find_matches() {
+        matches.clear();
+        match = 0;
+        const ColumnNames &keys = probe_keys();
+        const ColumnNames &other_keys = build_keys();
+        auto candidates = hash_table.equal_range(hash(*probe_row, keys));
+        for (auto candidate = candidates.first; candidate != candidates.second; candidate++) {
+            bool equal = true;
+            for (uint i = 0; i < keys.size() && equal; i++)
+                equal = probe_row->at(keys[i]) == candidate->second->at(other_keys[i]);
+            if (equal)
+                matches.push_back(candidate->second);
+        }
+    }
+
+    void create_files(std::vector<std::FILE *> &files) {
+        for (uint i = 0; i < partitions; i++) {
+            std::FILE *file = std::tmpfile();
+            if (file == nullptr)
+                throw DbRelationError("could not create a temporary file for a hash join");
+            files.push_back(file);
+        }
+    }
+
+    static void write(std::FILE *file, const void *data, size_t size) {
+        if (size > 0 && std::fwrite(data, size, 1, file) != 1)
+            throw DbRelationError("could not write a temporary file for a hash join");
+    }
+
+    static bool read(std::FILE *file, void *data, size_t size) {
+        return size == 0 || std::fread(data, size, 1, file) == 1;
+    }
+
+    // Write each build handle to the temporary file of its partition.
+    void spill_build(const Handles &handles) {
+        create_files(build_files);
+        const ColumnNames &keys = build_keys();
+        for (auto const &handle: handles) {
+            ValueDict *key = build_table->project(handle, &keys);
+            size_t h = hash(*key, keys);
+            delete key;
+            write(build_files[h % partitions], &handle, sizeof(Handle));
+        }
+    }
+
+    // Stream the probe rows into the temporary files of their partitions.
+    void spill_probe() {
+        create_files(probe_files);
+        const ColumnNames &keys = probe_keys();
+        probe->open();
+        ValueDict *row;
+        while ((row = probe->next()) != nullptr) {
+            try {
+                write_row(probe_files[hash(*row, keys) % partitions], *row);
+            } catch (...) {
+                delete row;
+                throw;
+            }
+            delete row;
+        }
+        probe->close();
+    }
+
+    static void write_string(std::FILE *file, const std::string &s) {
+        u_int32_t size = (u_int32_t) s.size();
+        write(file, &size, sizeof(size));
+        write(file, s.data(), size);
+    }
+
+    static bool read_string(std::FILE *file, std::string &s) {
+        u_int32_t size;
+        if (!read(file, &size, sizeof(size)))
+            return false;
+        s.resize(size);
+        return read(file, &s[0], size);
+    }
+
+    // Each row is its number of columns, then each column's name, data type, and value.
+    static void write_row(std::FILE *file, const ValueDict &row) {
+        u_int32_t size = (u_int32_t) row.size();
+        write(file, &size, sizeof(size));
+        for (auto const &column: row) {
+            write_string(file, column.first);
+            write(file, &column.second.data_type, sizeof(column.second.data_type));
+            if (column.second.data_type == ColumnAttribute::TEXT)
+                write_string(file, column.second.s);
+            else
+                write(file, &column.second.n, sizeof(column.second.n));
+        }
+    }
+
+    // The next row of a temporary file, or nullptr at its end.
+    static ValueDict *read_row(std::FILE *file) {
+        u_int32_t size;
+        if (!read(file, &size, sizeof(size)))
+            return nullptr;
+        ValueDict *row = new ValueDict();
+        for (u_int32_t i = 0; i < size; i++) {
+            Identifier column_name;
+            Value value;
+            bool ok = read_string(file, column_name) && read(file, &value.data_type, sizeof(value.data_type));
+            if (ok && value.data_type == ColumnAttribute::TEXT)
+                ok = read_string(file, value.s);
+            else if (ok)
+                ok = read(file, &value.n, sizeof(value.n));
+            if (!ok) {
+                delete row;
+                throw DbRelationError("could not read a temporary file for a hash join");
+            }
+            (*row)[column_name] = value;
+        }
+        return row;
+    }
+
+    // Read the current partition's build rows back into the hash table, and get ready to read its probe rows.
+    void load_partition() {
+        clear_hash_table();
+        Handles build_handles;
+        Handle handle;
+        std::rewind(build_files[partition]);
+        while (read(build_files[partition], &handle, sizeof(Handle)))
+            build_handles.push_back(handle);
+        build_hash_table(build_handles);
+        std::rewind(probe_files[partition]);
+    }
+};
+
+/**
+ * Join the rows of an outer plan with those of an indexed table by looking each outer row's keys up in the index,
+ * so only the inner rows that join are ever read. Outer rows are pulled PROBE_BATCH at a time and their keys looked
+ * up together with lookup_batch, which visits neighboring keys' leaves just once. The inner key columns can be more
+ * than the index's; the found rows are checked against all of them, and against the inner where clause, if any.
+ * Joined rows are named as in join_row.
+ */
+class IndexJoinOperator : public EvalOperator {
+public:
+    static const uint PROBE_BATCH = 256;
+
+    IndexJoinOperator(EvalOperator *outer, const DbRelation &outer_table, DbIndex &index,
+                      const Disjunction *inner_where, const ColumnNames &outer_keys, const ColumnNames &inner_keys)
+            : outer(outer), outer_table(outer_table), index(index), inner_where(inner_where),
+              outer_keys(outer_keys), inner_keys(inner_keys), outer_rows(), found(nullptr), position(0), match(0) {}
+
+    virtual ~IndexJoinOperator() {
+        clear_batch();
+        delete outer;
+    }
+
+    virtual void open() {
+        close();
+        outer->open();
+        index.open();
+    }
+
+    virtual ValueDict *next() {
+        while (true) {
+            if (position < outer_rows.size()) {
+                const ValueDict &outer_row = *outer_rows[position];
+                const Handles &handles = *(*found)[position];
+                while (match < handles.size()) {
+                    ValueDict *inner_row = index.get_relation().project(handles[match++]);
+                    if (joins(outer_row, *inner_row)) {
+                        ValueDict *row = join_row(outer_table, outer_row, index.get_relation(), *inner_row);
+                        delete inner_row;
+                        return row;
+                    }
+                    delete inner_row;
+                }
+                position++;
+                match = 0;
+                continue;
+            }
+            if (!next_batch())
+                return nullptr;
+        }
+    }
+
+    virtual void close() {
+        clear_batch();
+        outer->close();
+    }
+
+protected:
+    EvalOperator *outer;
+    const DbRelation &outer_table;
+    DbIndex &index;
+    const Disjunction *inner_where;  // nullptr if every inner row qualifies
+    const ColumnNames &outer_keys;
+    const ColumnNames &inner_keys;
+    ValueDicts outer_rows;  // the batch being joined
+    HandleLists *found;  // inner handles for each of them
+    uint position;  // the outer row being joined
+    uint match;  // next one of its handles
+
+    // Pull the next batch of outer rows and look up their keys. Returns false once the outer rows run out.
+    bool next_batch() {
+        clear_batch();
+        const ColumnNames &key_columns = index.get_key_columns();
+        ColumnAttributes *attributes = index.get_relation().get_column_attributes(key_columns);
+        ValueDicts keys;
+        ValueDict *row;
+        while (outer_rows.size() < PROBE_BATCH && (row = outer->next()) != nullptr) {
+            ValueDict *key = new ValueDict();
+            for (uint i = 0; i < key_columns.size() && key != nullptr; i++) {
+                const Identifier &outer_column = outer_keys[std::find(inner_keys.begin(), inner_keys.end(),
+                                                                      key_columns[i]) - inner_keys.begin()];
+                auto column = row->find(outer_column);
+                if (column == row->end()) {
+                    delete key;
+                    delete row;
+                    delete attributes;
+                    for (auto k: keys)
+                        delete k;
+                    throw DbRelationError("unknown column " + outer_column);
+                }
+                if (column->second.data_type != (*attributes)[i].get_data_type()) {
+                    delete key;  // a value of another type never equals the column's
+                    key = nullptr;
+                } else {
+                    (*key)[key_columns[i]] = column->second;
+                }
+            }
+            if (key == nullptr) {
+                delete row;
+                continue;
+            }
+            outer_rows.push_back(row);
+            keys.push_back(key);
+        }
+        delete attributes;
+        if (outer_rows.empty())
+            return false;
+        try {
+            found = index.lookup_batch(keys);
+        } catch (...) {
+            for (auto key: keys)
+                delete key;
+            throw;
+        }
+        for (auto key: keys)
+            delete key;
+        return true;
+    }
+
+    void clear_batch() {
+        for (auto row: outer_rows)
+            delete row;
+        outer_rows.clear();
+        if (found != nullptr)
+            for (auto handles: *found)
+                delete handles;
+        delete found;
+        found = nullptr;
+        position = match = 0;
+    }
+
+    bool joins(const ValueDict &outer_row, const ValueDict &inner_row) const {
+        for (uint i = 0; i < outer_keys.size(); i++)
+            if (outer_row.at(outer_keys[i]) != inner_row.at(inner_keys[i]))
+                return false;
+        return inner_where == nullptr || row_matches(&inner_row, *inner_where);
+    }
+};
+
+/**
+ * Cut each of the child's rows down to the given columns.
+ */
+class ProjectOperator : public EvalOperator {
+public:
+    ProjectOperator(EvalOperator *child, const ColumnNames *column_names) : child(child),
+                                                                            column_names(column_names) {}
+
+    virtual ~ProjectOperator() { delete child; }
+
+    virtual void open() { child->open(); }
+
+    virtual ValueDict *next() {
+        ValueDict *row = child->next();
+        if (row == nullptr)
+            return nullptr;
+        ValueDict *result = new ValueDict();
+        for (auto const &column_name: *column_names) {
+            auto column = row->find(column_name);
+            if (column == row->end()) {
+                delete row;
+                delete result;
+                throw DbRelationError("unknown column " + column_name);
+            }
+            (*result)[column_name] = column->second;
+        }
+        delete row;
+        return result;
+    }
+
+    virtual void close() { child->close(); }
+
+protected:
+    EvalOperator *child;
+    const ColumnNames *column_names;
+};
+
+bool EvalPlan::vectorized = true;
+
+u_long EvalPlan::join_memory = 100000;
+
+/**
+ * Pick the row-at-a-time or the vectorized scan.
+ */
+static EvalOperator *scan_operator(DbRelation &table, const Disjunction *where, const ColumnNames *column_names) {
+    if (EvalPlan::vectorized)
+        return new BatchScanOperator(table, where, column_names);
+    return new ScanOperator(table, where, column_names);
+}
+
 EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+                                                        select_where(nullptr), table(Dummy::one()), index(nullptr),
+                                                        index_key(nullptr), index_max(nullptr), min_inclusive(true),
+                                                        max_inclusive(true), branches(nullptr),
+                                                        right(nullptr), left_keys(nullptr), right_keys(nullptr) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
-                                                                  projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+                                                                  projection(projection), select_where(nullptr),
+                                                                  table(Dummy::one()), index(nullptr),
+                                                                  index_key(nullptr), index_max(nullptr),
+                                                                  min_inclusive(true), max_inclusive(true),
+                                                                  branches(nullptr),
+                                                                  right(nullptr), left_keys(nullptr),
+                                                                  right_keys(nullptr) {
 }
 
 EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+                                                                 select_where(
+                                                                         new Disjunction(1, equalities(conjunction))),
+                                                                 table(Dummy::one()), index(nullptr),
+                                                                 index_key(nullptr), index_max(nullptr),
+                                                                 min_inclusive(true), max_inclusive(true),
+                                                                 branches(nullptr),
+                                                                 right(nullptr), left_keys(nullptr),
+                                                                 right_keys(nullptr) {
+    delete conjunction;
+}
+
+EvalPlan::EvalPlan(Comparisons *conjunction, EvalPlan *relation) : type(Select), relation(relation),
+                                                                   projection(nullptr),
+                                                                   select_where(new Disjunction(1, *conjunction)),
+                                                                   table(Dummy::one()), index(nullptr),
+                                                                   index_key(nullptr), index_max(nullptr),
+                                                                   min_inclusive(true), max_inclusive(true),
+                                                                   branches(nullptr),
+                                                                   right(nullptr), left_keys(nullptr),
+                                                                   right_keys(nullptr) {
+    delete conjunction;
+}
+
+EvalPlan::EvalPlan(Disjunction *disjunction, EvalPlan *relation) : type(Select), relation(relation),
+                                                                   projection(nullptr), select_where(disjunction),
+                                                                   table(Dummy::one()), index(nullptr),
+                                                                   index_key(nullptr), index_max(nullptr),
+                                                                   min_inclusive(true), max_inclusive(true),
+                                                                   branches(nullptr),
+                                                                   right(nullptr), left_keys(nullptr),
+                                                                   right_keys(nullptr) {
 }
 
 EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+                                        select_where(nullptr), table(table), index(nullptr), index_key(nullptr),
+                                        index_max(nullptr), min_inclusive(true), max_inclusive(true),
+                                        branches(nullptr),
+                                        right(nullptr), left_keys(nullptr), right_keys(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *key) : type(IndexScan), relation(nullptr), projection(nullptr),
+                                                     select_where(nullptr), table(index.get_relation()),
+                                                     index(&index), index_key(key), index_max(nullptr),
+                                                     min_inclusive(true), max_inclusive(true), branches(nullptr),
+                                                     right(nullptr), left_keys(nullptr), right_keys(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *min_key, bool min_inclusive, ValueDict *max_key, bool max_inclusive)
+        : type(IndexRange), relation(nullptr), projection(nullptr), select_where(nullptr),
+          table(index.get_relation()), index(&index), index_key(min_key), index_max(max_key),
+          min_inclusive(min_inclusive), max_inclusive(max_inclusive), branches(nullptr),
+          right(nullptr), left_keys(nullptr), right_keys(nullptr) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(EvalPlans *branches) : type(Union), relation(nullptr), projection(nullptr), select_where(nullptr),
+                                          table(*branches->front()->base_table()), index(nullptr), index_key(nullptr),
+                                          index_max(nullptr), min_inclusive(true), max_inclusive(true),
+                                          branches(branches),
+                                          right(nullptr), left_keys(nullptr), right_keys(nullptr) {
+}
+
+EvalPlan::EvalPlan(EvalPlan *left, EvalPlan *right, ColumnNames *left_keys, ColumnNames *right_keys)
+        : type(Join), relation(left), projection(nullptr), select_where(nullptr), table(Dummy::one()),
+          index(nullptr), index_key(nullptr), index_max(nullptr), min_inclusive(true), max_inclusive(true),
+          branches(nullptr), right(right), left_keys(left_keys), right_keys(right_keys) {
+}
+
+EvalPlan::EvalPlan(EvalPlan *outer, DbIndex &index, Disjunction *inner_where, ColumnNames *outer_keys,
+                   ColumnNames *inner_keys)
+        : type(IndexJoin), relation(outer), projection(nullptr), select_where(inner_where),
+          table(index.get_relation()), index(&index), index_key(nullptr), index_max(nullptr), min_inclusive(true),
+          max_inclusive(true), branches(nullptr), right(nullptr), left_keys(outer_keys), right_keys(inner_keys) {
+}
+
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table), index(other->index),
+                                            min_inclusive(other->min_inclusive),
+                                            max_inclusive(other->max_inclusive) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
@@ -69,56 +916,930 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         projection = new ColumnNames(*other->projection);
     else
         projection = nullptr;
-    if (other->select_conjunction != nullptr)
-        select_conjunction = new ValueDict(*other->select_conjunction);
+    if (other->select_where != nullptr)
+        select_where = new Disjunction(*other->select_where);
+    else
+        select_where = nullptr;
+    if (other->index_key != nullptr)
+        index_key = new ValueDict(*other->index_key);
+    else
+        index_key = nullptr;
+    if (other->index_max != nullptr)
+        index_max = new ValueDict(*other->index_max);
+    else
+        index_max = nullptr;
+    if (other->branches != nullptr) {
+        branches = new EvalPlans();
+        for (auto branch: *other->branches)
+            branches->push_back(new EvalPlan(branch));
+    } else {
+        branches = nullptr;
+    }
+    if (other->right != nullptr)
+        right = new EvalPlan(other->right);
     else
-        select_conjunction = nullptr;
+        right = nullptr;
+    if (other->left_keys != nullptr)
+        left_keys = new ColumnNames(*other->left_keys);
+    else
+        left_keys = nullptr;
+    if (other->right_keys != nullptr)
+        right_keys = new ColumnNames(*other->right_keys);
+    else
+        right_keys = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
     delete projection;
-    delete select_conjunction;
+    delete select_where;
+    delete index_key;
+    delete index_max;
+    if (branches != nullptr)
+        for (auto branch: *branches)
+            delete branch;
+    delete branches;
+    delete right;
+    delete left_keys;
+    delete right_keys;
+}
+
+// Wrap plan in a Select of the rest of the conjunction, if there is any.
+static EvalPlan *residual(Comparisons *rest, EvalPlan *plan) {
+    if (rest->empty()) {
+        delete rest;
+        return plan;
+    }
+    return new EvalPlan(rest, plan);
+}
+
+// The rewrites are for a Select right over a TableScan. Each of its conjunctions has to be answerable from an
+// index (see index_plan); then the rows are the Union of what the index plans find, with no scan at all.
+// Otherwise the whole where clause is checked in a single pass over the table. A Select over a Join first has
+// whatever it can moved down to the sides of the join (see push_down), and a Join that can probe one of its sides
+// through an index becomes an IndexJoin (see index_join).
+EvalPlan *EvalPlan::optimize(const DbIndices *indices) {
+    if (this->type == Select && this->relation->type == Join && this->select_where->size() == 1) {
+        EvalPlan *plan = push_down(indices);
+        if (plan != nullptr)
+            return plan;
+    }
+    if (this->type == Select && this->relation->type == TableScan && !this->select_where->empty()) {
+        EvalPlans *plans = new EvalPlans();
+        for (auto const &conjunction: *this->select_where) {
+            EvalPlan *plan = index_plan(indices, this->relation->table, conjunction);
+            if (plan == nullptr)
+                break;
+            plans->push_back(plan);
+        }
+        if (plans->size() == this->select_where->size()) {
+            if (plans->size() == 1) {
+                EvalPlan *plan = plans->front();
+                delete plans;
+                return plan;
+            }
+            return new EvalPlan(plans);
+        }
+        for (auto plan: *plans)
+            delete plan;
+        delete plans;
+    }
+
+    EvalPlan *plan = new EvalPlan(this);
+    if (this->relation != nullptr) {
+        delete plan->relation;
+        plan->relation = this->relation->optimize(indices);
+    }
+    if (this->right != nullptr) {
+        delete plan->right;
+        plan->right = this->right->optimize(indices);
+    }
+    if (plan->type == Join) {
+        EvalPlan *index_join = plan->index_join(indices);
+        if (index_join != nullptr) {
+            delete plan;
+            return index_join;
+        }
+    }
+    return plan;
+}
+
+// Plan for the rows of table matching a conjunction that uses an index instead of scanning, or nullptr if none
+// of the indices help. If the conjunction gives a value (or an IN-list of them) for every key column of one of the
+// table's indices, look the keys up; failing that, if it bounds the key column of a one-column index, walk that
+// range of the index. Either way, only the rows found are filtered by whatever is left of the conjunction.
+EvalPlan *EvalPlan::index_plan(const DbIndices *indices, DbRelation &table, const Comparisons &conjunction) {
+    EvalPlan *plan = index_scan(indices, table, conjunction);
+    if (plan == nullptr)
+        plan = index_range(indices, table, conjunction);
+    return plan;
+}
+
+// Which side of a join a where column is about: 0 for the left table, 1 for the right, or -1 if both or neither have
+// it. A column named <table>.<column> (as joined rows name them) goes by the table; column_name gets the plain name.
+static int join_side(const DbRelation &left, const DbRelation &right, const Identifier &where_column,
+                     Identifier &column_name) {
+    const DbRelation *const tables[2] = {&left, &right};
+    for (int side = 0; side < 2; side++) {
+        const Identifier &table_name = tables[side]->get_table_name();
+        if (where_column.compare(0, table_name.size() + 1, table_name + ".") == 0) {
+            column_name = where_column.substr(table_name.size() + 1);
+            const ColumnNames &column_names = tables[side]->get_column_names();
+            if (std::find(column_names.begin(), column_names.end(), column_name) != column_names.end())
+                return side;
+        }
+    }
+    column_name = where_column;
+    bool in[2];
+    for (int side = 0; side < 2; side++) {
+        const ColumnNames &column_names = tables[side]->get_column_names();
+        in[side] = std::find(column_names.begin(), column_names.end(), column_name) != column_names.end();
+    }
+    if (in[0] == in[1])
+        return -1;
+    return in[0] ? 0 : 1;
 }
 
+// Move the comparisons of a Select over a Join that are about the columns of just one side down onto that side,
+// where they cut down the rows going into the join (and may let that side use an index). The rest stay above
+// the join. Returns nullptr if nothing moves.
+EvalPlan *EvalPlan::push_down(const DbIndices *indices) const {
+    const EvalPlan *join = this->relation;
+    const DbRelation *left = join->relation->base_table();
+    const DbRelation *right = join->right->base_table();
+    if (left == nullptr || right == nullptr)
+        return nullptr;
+    Comparisons *left_where = new Comparisons();
+    Comparisons *right_where = new Comparisons();
+    Comparisons *rest = new Comparisons();
+    for (auto const &predicate: this->select_where->front()) {
+        Comparison pushed = predicate;
+        int side = join_side(*left, *right, predicate.column_name, pushed.column_name);
+        if (side == 0)
+            left_where->push_back(pushed);
+        else if (side == 1)
+            right_where->push_back(pushed);
+        else
+            rest->push_back(predicate);
+    }
+    if (left_where->empty() && right_where->empty()) {
+        delete left_where;
+        delete right_where;
+        delete rest;
+        return nullptr;
+    }
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+    EvalPlan *left_plan = residual(left_where, new EvalPlan(join->relation));
+    EvalPlan *right_plan = residual(right_where, new EvalPlan(join->right));
+    EvalPlan *pushed = residual(rest, new EvalPlan(left_plan, right_plan, new ColumnNames(*join->left_keys),
+                                                   new ColumnNames(*join->right_keys)));
+    EvalPlan *plan = pushed->optimize(indices);
+    delete pushed;
+    return plan;
+}
+
+// Rewrite a Join (with its sides already optimized) into an IndexJoin if one side just scans a table, filtered or
+// not, that has an index whose key columns are all among that side's join columns. The other side's rows are then
+// streamed and each one's matches looked up in the index, instead of the whole scanned table going into a hash
+// table. The right side is the one probed if it can be, unless the left side is a bare scan and the right one is
+// not (the filtered side is likely the smaller one, so it should be the outer one). Returns nullptr if neither side
+// can be probed, or if a side joins more than one table.
+EvalPlan *EvalPlan::index_join(const DbIndices *indices) const {
+    if (this->relation->base_table() == nullptr || this->right->base_table() == nullptr)
+        return nullptr;
+    DbIndex *left_index = join_index(indices, this->relation, *this->left_keys);
+    DbIndex *right_index = join_index(indices, this->right, *this->right_keys);
+    if (left_index == nullptr && right_index == nullptr)
+        return nullptr;
+    bool probe_left = right_index == nullptr ||
+                      (left_index != nullptr && this->relation->type == TableScan && this->right->type != TableScan);
+    const EvalPlan *outer = probe_left ? this->right : this->relation;
+    const EvalPlan *inner = probe_left ? this->relation : this->right;
+    Disjunction *inner_where = inner->type == Select ? new Disjunction(*inner->select_where) : nullptr;
+    return new EvalPlan(new EvalPlan(outer), probe_left ? *left_index : *right_index, inner_where,
+                        new ColumnNames(probe_left ? *this->right_keys : *this->left_keys),
+                        new ColumnNames(probe_left ? *this->left_keys : *this->right_keys));
+}
+
+// The index a side of a Join could be probed through on the given join columns (chosen as by choose_index), or
+// nullptr if the side isn't a scan of a table, filtered or not, or none of the table's indices fit.
+DbIndex *EvalPlan::join_index(const DbIndices *indices, const EvalPlan *side, const ColumnNames &keys) {
+    const EvalPlan *scan = side->type == Select ? side->relation : side;
+    if (scan->type != TableScan)
+        return nullptr;
+    ColumnAttributes *attributes = scan->table.get_column_attributes(keys);
+    Comparisons given;
+    for (uint i = 0; i < keys.size(); i++) {
+        Value value;  // stands in for the other side's values, which are of the column's type when they join
+        value.data_type = (*attributes)[i].get_data_type();
+        given.push_back(Comparison(keys[i], Comparison::EQ, value));
+    }
+    delete attributes;
+    return choose_index(indices, scan->table, &given);
+}
+
+// The table a plan of just one table reads, or nullptr for a Join.
+DbRelation *EvalPlan::base_table() const {
+    switch (this->type) {
+        case TableScan:
+        case IndexScan:
+        case IndexRange:
+        case Union:
+            return &this->table;
+        case Join:
+        case IndexJoin:
+            return nullptr;
+        default:
+            return this->relation->base_table();
+    }
+}
+
+// Whether a predicate gives values an index lookup on a key column of the given data type can use: an equality
+// with a value of that type, or an IN-list with at least one. A value of another type never equals the column's, so
+// it can't be marshalled into a key; such a predicate is left for the filter.
+static bool gives_key(const Comparison &predicate, ColumnAttribute::DataType data_type) {
+    if (predicate.op == Comparison::EQ)
+        return predicate.value.data_type == data_type;
+    if (predicate.op == Comparison::IN)
+        for (auto const &value: predicate.values)
+            if (value.data_type == data_type)
+                return true;
+    return false;
+}
+
+// Equality rewrite for index_plan: nullptr if no index's whole key is given. An IN-list for a key column makes a
+// key for each of its values of the column's type (and for each of the other key columns' values), looked up by a
+// Union; its values of other types can't match anyway.
+EvalPlan *EvalPlan::index_scan(const DbIndices *indices, DbRelation &table, const Comparisons &conjunction) {
+    DbIndex *index = choose_index(indices, table, &conjunction);
+    if (index == nullptr)
+        return nullptr;
+    const ColumnNames &key_columns = index->get_key_columns();
+    ColumnAttributes *attributes = table.get_column_attributes(key_columns);
+    ValueDicts keys(1, new ValueDict());
+    ColumnNames keyed;
+    Comparisons *rest = new Comparisons();
+    for (auto const &predicate: conjunction) {
+        auto key_column = std::find(key_columns.begin(), key_columns.end(), predicate.column_name);
+        ColumnAttribute::DataType data_type = ColumnAttribute::INT;
+        if (key_column != key_columns.end())
+            data_type = (*attributes)[key_column - key_columns.begin()].get_data_type();
+        if (key_column == key_columns.end() || !gives_key(predicate, data_type) ||
+            std::find(keyed.begin(), keyed.end(), predicate.column_name) != keyed.end()) {
+            rest->push_back(predicate);
+            continue;
+        }
+        keyed.push_back(predicate.column_name);
+        if (predicate.op == Comparison::EQ) {
+            for (auto key: keys)
+                (*key)[predicate.column_name] = predicate.value;
+            continue;
+        }
+        ValueDicts product;
+        for (auto key: keys) {
+            for (auto const &value: predicate.values) {
+                if (value.data_type != data_type)
+                    continue;
+                ValueDict *next = new ValueDict(*key);
+                (*next)[predicate.column_name] = value;
+                product.push_back(next);
+            }
+            delete key;
+        }
+        keys.swap(product);
+    }
+    delete attributes;
+    if (keys.size() == 1)
+        return residual(rest, new EvalPlan(*index, keys.front()));
+    EvalPlans *lookups = new EvalPlans();
+    for (auto key: keys)
+        lookups->push_back(new EvalPlan(*index, key));
+    return residual(rest, new EvalPlan(lookups));
+}
+
+// Range rewrite for index_plan: nullptr if no one-column index's column is bounded. Several bounds on the same side
+// keep the tightest one (the others are implied by it), and an index bounded on both sides beats one bounded on
+// only one side. Values of a different data type than the column never bound it; they're left for the filter.
+EvalPlan *EvalPlan::index_range(const DbIndices *indices, DbRelation &table, const Comparisons &conjunction) {
+    if (indices == nullptr)
+        return nullptr;
+    DbIndex *best = nullptr;
+    const Comparison *best_min = nullptr, *best_max = nullptr;
+    for (auto index: *indices) {
+        if (index->get_relation().get_table_name() != table.get_table_name() || index->get_key_columns().size() != 1)
+            continue;
+        const Identifier &column_name = index->get_key_columns()[0];
+        ColumnAttributes *attributes = table.get_column_attributes(index->get_key_columns());
+        ColumnAttribute::DataType data_type = (*attributes)[0].get_data_type();
+        delete attributes;
+        const Comparison *min = nullptr, *max = nullptr;
+        for (auto const &predicate: conjunction) {
+            if (predicate.column_name != column_name || predicate.op == Comparison::IN ||
+                predicate.value.data_type != data_type)
+                continue;
+            if (predicate.op == Comparison::GT || predicate.op == Comparison::GE) {
+                if (min == nullptr || min->value < predicate.value ||
+                    (min->value == predicate.value && predicate.op == Comparison::GT))
+                    min = &predicate;
+            } else if (predicate.op == Comparison::LT || predicate.op == Comparison::LE) {
+                if (max == nullptr || predicate.value < max->value ||
+                    (max->value == predicate.value && predicate.op == Comparison::LT))
+                    max = &predicate;
+            }
+        }
+        if (min == nullptr && max == nullptr)
+            continue;
+        if (best == nullptr || ((min != nullptr && max != nullptr) && (best_min == nullptr || best_max == nullptr))) {
+            best = index;
+            best_min = min;
+            best_max = max;
+        }
+    }
+    if (best == nullptr)
+        return nullptr;
+
+    const Identifier &column_name = best->get_key_columns()[0];
+    ValueDict *min_key = nullptr, *max_key = nullptr;
+    if (best_min != nullptr) {
+        min_key = new ValueDict();
+        (*min_key)[column_name] = best_min->value;
+    }
+    if (best_max != nullptr) {
+        max_key = new ValueDict();
+        (*max_key)[column_name] = best_max->value;
+    }
+    ColumnAttribute::DataType data_type = (best_min != nullptr ? best_min : best_max)->value.data_type;
+    Comparisons *rest = new Comparisons();
+    for (auto const &predicate: conjunction)
+        if (predicate.column_name != column_name || predicate.value.data_type != data_type ||
+            predicate.op == Comparison::EQ || predicate.op == Comparison::NE || predicate.op == Comparison::IN)
+            rest->push_back(predicate);
+    return residual(rest, new EvalPlan(*best, min_key, best_min == nullptr || best_min->op == Comparison::GE,
+                                       max_key, best_max == nullptr || best_max->op == Comparison::LE));
+}
+
+// Pick the index on table that the conjunction's equalities (and IN-lists) give a whole key for, with values of the
+// key columns' types, preferring a unique one, then the one with the most key columns. Returns nullptr if there
+// isn't one.
+DbIndex *EvalPlan::choose_index(const DbIndices *indices, const DbRelation &table, const Comparisons *conjunction) {
+    if (indices == nullptr)
+        return nullptr;
+    DbIndex *best = nullptr;
+    for (auto index: *indices) {
+        if (index->get_relation().get_table_name() != table.get_table_name())
+            continue;
+        const ColumnNames &key_columns = index->get_key_columns();
+        ColumnAttributes *attributes = table.get_column_attributes(key_columns);
+        bool covered = true;
+        for (uint i = 0; i < key_columns.size(); i++) {
+            bool given = false;
+            for (auto const &predicate: *conjunction)
+                if (predicate.column_name == key_columns[i] && gives_key(predicate, (*attributes)[i].get_data_type()))
+                    given = true;
+            if (!given)
+                covered = false;
+        }
+        delete attributes;
+        if (!covered)
+            continue;
+        if (best == nullptr || (index->is_unique() && !best->is_unique()) ||
+            (index->is_unique() == best->is_unique() &&
+             index->get_key_columns().size() > best->get_key_columns().size()))
+            best = index;
+    }
+    return best;
 }
 
-ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+ValueDicts *EvalPlan::evaluate(u_long limit) {
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
+    ValueDicts *ret = new ValueDicts();
+    EvalOperator *root = compile();
+    try {
+        root->open();
+        ValueDict *row;
+        while ((limit == 0 || ret->size() < limit) && (row = root->next()) != nullptr)
+            ret->push_back(row);
+        root->close();
+    } catch (...) {
+        delete root;
+        for (auto row: *ret)
+            delete row;
+        delete ret;
+        throw;
+    }
+    delete root;
     return ret;
 }
 
+EvalOperator *EvalPlan::compile() {
+    switch (this->type) {
+        case TableScan:
+            return scan_operator(this->table, nullptr, nullptr);
+
+        case IndexScan:
+            return new IndexScanOperator(*this->index, this->index_key, nullptr);
+
+        case IndexRange:
+            return new IndexRangeOperator(*this->index, this->index_key, this->min_inclusive, this->index_max,
+                                          this->max_inclusive, nullptr);
+
+        case Union:
+            return new PipelineOperator(*this, nullptr);
+
+        case Join:
+            return new HashJoinOperator(*this->relation, *this->right, *this->left_keys, *this->right_keys);
+
+        case IndexJoin:
+            return new IndexJoinOperator(this->relation->compile(), *this->relation->base_table(), *this->index,
+                                         this->select_where, *this->left_keys, *this->right_keys);
+
+        case Select:
+            // push the selection into the scan when we can, otherwise filter the rows coming up
+            if (this->relation->type == TableScan)
+                return scan_operator(this->relation->table, this->select_where, nullptr);
+            return new FilterOperator(this->relation->compile(), this->select_where);
+
+        case ProjectAll:
+            return this->relation->compile();
+
+        case Project:
+            // push the projection into the scan when we can
+            if (this->relation->type == TableScan)
+                return scan_operator(this->relation->table, nullptr, this->projection);
+            if (this->relation->type == IndexScan)
+                return new IndexScanOperator(*this->relation->index, this->relation->index_key, this->projection);
+            if (this->relation->type == IndexRange)
+                return new IndexRangeOperator(*this->relation->index, this->relation->index_key,
+                                              this->relation->min_inclusive, this->relation->index_max,
+                                              this->relation->max_inclusive, this->projection);
+            if (this->relation->type == Union)
+                return new PipelineOperator(*this->relation, this->projection);
+            if (this->relation->type == Select && this->relation->relation->type == TableScan)
+                return scan_operator(this->relation->relation->table, this->relation->select_where,
+                                     this->projection);
+            return new ProjectOperator(this->relation->compile(), this->projection);
+    }
+    throw DbRelationError("Not implemented: compiling this kind of plan");
+}
+
 EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
+    if (this->type == IndexScan) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->lookup(this->index_key));
+    }
+    if (this->type == IndexRange) {
+        this->index->open();
+        Handles *handles = new Handles();
+        HandleCursor *cursor = this->index->range_cursor(this->index_key, this->index_max, this->min_inclusive,
+                                                         this->max_inclusive);
+        Handle handle;
+        while (cursor->next(handle))
+            handles->push_back(handle);
+        delete cursor;
+        return EvalPipeline(&this->table, handles);
+    }
     if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_where));
 
-    // recursive case
+    // recursive cases
+    if (this->type == Union)
+        return union_pipeline();
     if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
         Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
+        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_where));
         delete handles;
         return ret;
     }
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+    // joined rows span two relations, so there are no handles to give for them
+    if (this->type == Join || this->type == IndexJoin)
+        throw DbRelationError("a join has no pipeline of handles; evaluate it instead");
+    throw DbRelationError("Not implemented: pipeline other than Select, TableScan, IndexScan, IndexRange, or Union");
 }
 
+// Merge the handles of the branches in handle order, each just once. Plain lookups in the same index go together
+// into one lookup_batch, which reads each leaf only once for neighboring keys.
+EvalPipeline EvalPlan::union_pipeline() {
+    HandleLists lists;
+    ValueDicts keys;
+    DbIndex *lookup_index = nullptr;
+    for (auto branch: *this->branches) {
+        if (branch->type == IndexScan && (lookup_index == nullptr || lookup_index == branch->index)) {
+            lookup_index = branch->index;
+            keys.push_back(branch->index_key);
+            continue;
+        }
+        lists.push_back(branch->pipeline().second);
+    }
+    if (lookup_index != nullptr) {
+        lookup_index->open();
+        HandleLists *found = lookup_index->lookup_batch(keys);
+        lists.insert(lists.end(), found->begin(), found->end());
+        delete found;
+    }
+    return EvalPipeline(&this->table, merge_handles(lists));
+}
+
+
+// Test helper: evaluate a plan and check each row has just the given columns, with a passing the check.
+static bool test_rows(EvalPlan &plan, u_long limit, uint expected, uint columns, bool (*check)(int)) {
+    ValueDicts *rows = plan.evaluate(limit);
+    bool ok = rows->size() == expected;
+    for (auto row: *rows) {
+        ok = ok && row->size() == columns && check(row->at("a").n);
+        delete row;
+    }
+    delete rows;
+    return ok;
+}
+
+// Test the operator tree compile() makes for each plan shape, and that evaluate() stops pulling rows at its limit.
+static bool test_operators(DbRelation &table, uint count, u_long blocks) {
+    for (int vectorized = 0; vectorized < 2; vectorized++) {
+        EvalPlan::vectorized = vectorized == 1;
+
+        // the limit stops the scan before it reads the whole table
+        EvalPlan all(EvalPlan::ProjectAll, new EvalPlan(table));
+        u_long fetches = _BUFFER_POOL->get_misses() + _BUFFER_POOL->get_hits();
+        if (!test_rows(all, 5, 5, 3, [](int a) { return a < 5; })) {
+            std::cout << "limit failed" << std::endl;
+            return false;
+        }
+        fetches = _BUFFER_POOL->get_misses() + _BUFFER_POOL->get_hits() - fetches;
+        if (fetches >= blocks || !test_rows(all, 0, count, 3, [](int a) { return true; })) {
+            std::cout << "limit failed: " << fetches << " fetches" << std::endl;
+            return false;
+        }
+
+        // projection and where clause both go into the scan
+        ValueDict *where = new ValueDict();
+        (*where)["b"] = Value("s3");
+        EvalPlan pushed(new ColumnNames(1, "a"), new EvalPlan(where, new EvalPlan(table)));
+        EvalOperator *root = pushed.compile();
+        bool scan = vectorized ? dynamic_cast<BatchScanOperator *>(root) != nullptr
+                               : dynamic_cast<ScanOperator *>(root) != nullptr;
+        delete root;
+        if (!scan || !test_rows(pushed, 0, count / 10, 1, [](int a) { return a % 10 == 3; })) {
+            std::cout << "pushed down projection failed" << std::endl;
+            return false;
+        }
+
+        // a Select over a Select filters the rows coming out of the scan, and a projection of that is done on top
+        where = new ValueDict();
+        (*where)["c"] = Value(3);
+        EvalPlan *inner = new EvalPlan(where, new EvalPlan(table));
+        where = new ValueDict();
+        (*where)["b"] = Value("s3");
+        EvalPlan filtered(where, inner);
+        EvalPlan stacked(new ColumnNames(1, "a"), new EvalPlan(&filtered));
+        root = filtered.compile();
+        bool filter = dynamic_cast<FilterOperator *>(root) != nullptr;
+        delete root;
+        root = stacked.compile();
+        filter = filter && dynamic_cast<ProjectOperator *>(root) != nullptr;
+        delete root;
+        uint expected = 0;
+        for (uint i = 0; i < count; i++)
+            if (i % 10 == 3 && i % 7 == 3)
+                expected++;
+        if (!filter || !test_rows(stacked, 0, expected, 1, [](int a) { return a % 10 == 3 && a % 7 == 3; })) {
+            std::cout << "filter failed" << std::endl;
+            return false;
+        }
+    }
+    EvalPlan::vectorized = true;
+    return true;
+}
+
+// Test helper: evaluate both plans (freeing them) and check they give the same rows, in any order.
+static bool test_same_rows(EvalPlan *plan, EvalPlan *expected, uint &count) {
+    ValueDicts *rows[2] = {EvalPlan(EvalPlan::ProjectAll, plan).evaluate(),
+                           EvalPlan(EvalPlan::ProjectAll, expected).evaluate()};
+    std::vector<ValueDict> sorted[2];
+    for (int i = 0; i < 2; i++) {
+        for (auto row: *rows[i]) {
+            sorted[i].push_back(*row);
+            delete row;
+        }
+        delete rows[i];
+        std::sort(sorted[i].begin(), sorted[i].end());
+    }
+    count = (uint) sorted[0].size();
+    return sorted[0] == sorted[1];
+}
+
+// Test helper: a Select of the given equalities over a scan of the table
+static EvalPlan *test_select(DbRelation &table, const ValueDict &where) {
+    return new EvalPlan(new ValueDict(where), new EvalPlan(table));
+}
+
+// Test that optimize() turns equality selects into lookups in the best index whose key they give, leaving a
+// Select for whatever else is in the where clause, and that the rows stay the same.
+static bool test_index_scans(DbRelation &table) {
+    ColumnNames c_b;
+    c_b.push_back("c");
+    c_b.push_back("b");
+    BTreeIndex by_c(table, "__test_eval_plan_c", ColumnNames(1, "c"), false);
+    BTreeIndex by_c_b(table, "__test_eval_plan_c_b", c_b, false);
+    BTreeIndex by_a(table, "__test_eval_plan_a", ColumnNames(1, "a"), true);
+    by_c.create();
+    by_c_b.create();
+    by_a.create();
+    DbIndices indices;
+    indices.push_back(&by_c);
+    indices.push_back(&by_c_b);
+    indices.push_back(&by_a);
+
+    struct {
+        int a, c;  // -1 to leave out of the where clause
+        const char *b;  // nullptr to leave out
+        const DbIndex *index;  // expected choice
+        bool residual;  // whether a Select is expected over the lookup
+        uint rows;
+    } cases[] = {
+            {17, -1, nullptr, &by_a,   false, 1},
+            {17, -1, "s7",    &by_a,   true,  1},  // a = 17, b = 's7'
+            {17, -1, "s3",    &by_a,   true,  0},
+            {-1, 3,  "s3",    &by_c_b, false, 29},  // the wider index
+            {10, 3,  nullptr, &by_a,   true,  1},  // the unique index
+            {-1, 3,  nullptr, &by_c,   false, 286},
+    };
+    bool ok = true;
+    for (auto const &test: cases) {
+        ValueDict where;
+        if (test.a >= 0)
+            where["a"] = Value(test.a);
+        if (test.b != nullptr)
+            where["b"] = Value(test.b);
+        if (test.c >= 0)
+            where["c"] = Value(test.c);
+        EvalPlan *select = test_select(table, where);
+        EvalPlan *optimized = select->optimize(&indices);
+        const EvalPlan *lookup = test.residual ? optimized->get_relation() : optimized;
+        bool chose = (optimized->get_type() == EvalPlan::Select) == test.residual &&
+                     lookup->get_type() == EvalPlan::IndexScan && lookup->get_index() == test.index;
+        uint count;
+        if (!chose || !test_same_rows(optimized, select, count) || count != test.rows) {
+            std::cout << "index scan failed: a=" << test.a << " b=" << (test.b ? test.b : "") << " c=" << test.c
+                      << std::endl;
+            ok = false;
+            break;
+        }
+    }
+
+    // the Union of the lookups reads its rows from the table, even when its first branch has a residual Select
+    Disjunction *either = new Disjunction();
+    Comparisons first;
+    first.push_back(Comparison("a", Comparison::EQ, Value(1)));
+    first.push_back(Comparison("b", Comparison::EQ, Value("s1")));
+    either->push_back(first);
+    either->push_back(Comparisons(1, Comparison("a", Comparison::EQ, Value(2))));
+    EvalPlan *select = new EvalPlan(either, new EvalPlan(table));
+    EvalPlan *optimized = select->optimize(&indices);
+    bool united = optimized->get_type() == EvalPlan::Union;
+    uint count;
+    if (!test_same_rows(optimized, select, count) || !united || count != 2) {
+        std::cout << "index scan union failed" << std::endl;
+        ok = false;
+    }
+
+    // values of another type than a key column are left for the filter: b = 7 doesn't give the key of (c, b), and
+    // a = 'zzz' not that of a; an IN-list only looks up its values of the column's type
+    Comparisons *wrong_b = new Comparisons();
+    wrong_b->push_back(Comparison("c", Comparison::EQ, Value(3)));
+    wrong_b->push_back(Comparison("b", Comparison::EQ, Value(7)));
+    Comparisons *wrong_a = new Comparisons(1, Comparison("a", Comparison::EQ, Value("zzz")));
+    std::vector<Value> values;
+    values.push_back(Value(5));
+    values.push_back(Value("x"));
+    values.push_back(Value(6));
+    Comparisons *mixed_in = new Comparisons(1, Comparison("a", values));
+    struct {
+        Comparisons *where;
+        EvalPlan::PlanType type;  // expected plan
+        const DbIndex *index;  // expected index under the Select, if any
+        uint rows;
+    } typed[] = {
+            {wrong_b,  EvalPlan::Select, &by_c,   0},
+            {wrong_a,  EvalPlan::Select, nullptr, 0},
+            {mixed_in, EvalPlan::Union,  nullptr, 2},
+    };
+    for (auto const &test: typed) {
+        select = new EvalPlan(test.where, new EvalPlan(table));
+        optimized = select->optimize(&indices);
+        bool chose = optimized->get_type() == test.type &&
+                     (test.type != EvalPlan::Select || optimized->get_relation()->get_index() == test.index);
+        if (!test_same_rows(optimized, select, count) || !chose || count != test.rows) {
+            std::cout << "index scan with a value of another type failed" << std::endl;
+            ok = false;
+        }
+    }
+    by_a.drop();
+    by_c_b.drop();
+    by_c.drop();
+    return ok;
+}
+
+// Test helper: a HashJoinOperator that tells which side it hashed and into how many partitions
+class TestHashJoinOperator : public HashJoinOperator {
+public:
+    TestHashJoinOperator(EvalPlan &left, EvalPlan &right, const ColumnNames &left_keys, const ColumnNames &right_keys)
+            : HashJoinOperator(left, right, left_keys, right_keys) {}
+
+    bool builds_left() const { return build_is_left; }
+
+    uint get_partitions() const { return partitions; }
+};
+
+// Test helper: whether a row of __test_eval_plan joined on a = x with __test_eval_plan_r has the right values
+// under the right names
+static bool test_joined_row(const ValueDict &row) {
+    return row.size() == 10 && row.at("a") == row.at("x") && row.at("v").n % 2500 == row.at("x").n &&
+           row.at("__test_eval_plan.a") == row.at("a") && row.at("__test_eval_plan_r.x") == row.at("x") &&
+           row.at("__test_eval_plan.b").s == "s" + std::to_string(row.at("a").n % 10) &&
+           row.at("__test_eval_plan_r.b").s == "r" + std::to_string(row.at("v").n) &&
+           row.find("b") == row.end();
+}
+
+// Test helper: run a join and check how many rows it gives, and each of them
+static bool test_join_rows(EvalOperator &join, uint expected) {
+    join.open();
+    uint count = 0;
+    bool ok = true;
+    ValueDict *row;
+    while ((row = join.next()) != nullptr) {
+        ok = ok && test_joined_row(*row);
+        count++;
+        delete row;
+    }
+    join.close();
+    return ok && count == expected;
+}
+
+// Test the hash join: it hashes the smaller side, gives the same rows whether or not it spills to partitions, and
+// names the columns of the joined rows; a Select over it is pushed down to the side it is about.
+static bool test_hash_join(DbRelation &left, DbRelation &right) {
+    const uint expected = 2500;  // the left table's a goes up to 1999
+    ColumnNames left_keys(1, "a"), right_keys(1, "x");
+    EvalPlan left_scan(left), right_scan(right);
+    bool ok = true;
+
+    TestHashJoinOperator in_memory(left_scan, right_scan, left_keys, right_keys);
+    if (!test_join_rows(in_memory, expected) || !in_memory.builds_left()) {
+        std::cout << "hash join failed" << std::endl;
+        ok = false;
+    }
+    EvalPlan::join_memory = 300;
+    TestHashJoinOperator spilled(left_scan, right_scan, left_keys, right_keys);
+    spilled.open();
+    uint partitions = spilled.get_partitions();
+    spilled.close();
+    if (ok && (partitions != 14 || !test_join_rows(spilled, expected))) {
+        std::cout << "hash join spill failed: " << partitions << " partitions" << std::endl;
+        ok = false;
+    }
+    EvalPlan::join_memory = 100000;
+
+    EvalPlan first_hundred(new Comparisons(1, Comparison("v", Comparison::LT, Value(100))), new EvalPlan(right));
+    TestHashJoinOperator smaller_right(left_scan, first_hundred, left_keys, right_keys);
+    if (ok && (!test_join_rows(smaller_right, 100) || smaller_right.builds_left())) {
+        std::cout << "hash join build side failed" << std::endl;
+        ok = false;
+    }
+
+    // b is in both tables, so a where clause on one of them names it by its table
+    Comparisons *where = new Comparisons(1, Comparison("__test_eval_plan_r.b", Comparison::EQ, Value("r7")));
+    EvalPlan select(where, new EvalPlan(new EvalPlan(left), new EvalPlan(right), new ColumnNames(left_keys),
+                                        new ColumnNames(right_keys)));
+    EvalPlan *optimized = select.optimize();
+    bool pushed = optimized->get_type() == EvalPlan::Join;
+    uint count;
+    if (!test_same_rows(optimized, new EvalPlan(&select), count) || !pushed || count != 1) {
+        std::cout << "hash join push down failed" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+// Test helper: optimize a join of the two tables' scans (each under a Select of the given comparison, if any) and
+// check that it becomes an IndexJoin probing the given index, from the given kind of outer plan, and gives the same
+// rows as the hash join.
+static bool test_index_join(DbRelation &left, const Comparison *left_where, DbRelation &right,
+                            const Comparison *right_where, const Identifier &left_key, const DbIndices &indices,
+                            const DbIndex *index, EvalPlan::PlanType outer_type, uint expected) {
+    EvalPlan *left_plan = new EvalPlan(left), *right_plan = new EvalPlan(right);
+    if (left_where != nullptr)
+        left_plan = new EvalPlan(new Comparisons(1, *left_where), left_plan);
+    if (right_where != nullptr)
+        right_plan = new EvalPlan(new Comparisons(1, *right_where), right_plan);
+    EvalPlan join(left_plan, right_plan, new ColumnNames(1, left_key), new ColumnNames(1, "x"));
+    EvalPlan *optimized = join.optimize(&indices);
+    bool chose = optimized->get_type() == EvalPlan::IndexJoin && optimized->get_index() == index &&
+                 optimized->get_relation()->get_type() == outer_type;
+    uint count;
+    return test_same_rows(optimized, new EvalPlan(&join), count) && chose && count == expected;
+}
+
+// Test that optimize() turns a join into an IndexJoin when a side's table has an index on its join column, keeping
+// a filtered side as the outer one, and that the IndexJoin finds the same rows as the hash join.
+static bool test_index_joins(DbRelation &left, DbRelation &right) {
+    BTreeIndex by_a(left, "__test_eval_plan_a", ColumnNames(1, "a"), true);
+    BTreeIndex by_x(right, "__test_eval_plan_r_x", ColumnNames(1, "x"), false);
+    by_a.create();
+    by_x.create();
+    DbIndices just_x(1, &by_x), both;
+    both.push_back(&by_a);
+    both.push_back(&by_x);
+    Comparison first_hundred("v", Comparison::LT, Value(100)), c_is_3("c", Comparison::EQ, Value(3));
+    uint c_3 = 0, c_3_first_hundred = 0;  // rows with c = 3 that join (a goes up to 1999, x to 2499)
+    for (int j = 0; j < 3000; j++)
+        if (j % 2500 < 2000 && j % 2500 % 7 == 3) {
+            c_3++;
+            if (j < 100)
+                c_3_first_hundred++;
+        }
+
+    bool ok = true;
+    if (!test_index_join(left, nullptr, right, nullptr, "a", just_x, &by_x, EvalPlan::TableScan, 2500)) {
+        std::cout << "index join failed" << std::endl;
+        ok = false;
+    }
+    // both sides have an index, but the right side is filtered, so it stays outer (inner rows get checked by the
+    // where clause of their side, too)
+    if (ok && !test_index_join(left, nullptr, right, &first_hundred, "a", both, &by_a, EvalPlan::Select, 100)) {
+        std::cout << "index join outer side failed" << std::endl;
+        ok = false;
+    }
+    if (ok && !test_index_join(left, &c_is_3, right, nullptr, "a", just_x, &by_x, EvalPlan::Select, c_3)) {
+        std::cout << "index join with outer where clause failed" << std::endl;
+        ok = false;
+    }
+    if (ok && !test_index_join(left, &c_is_3, right, &first_hundred, "a", DbIndices(1, &by_a), &by_a,
+                               EvalPlan::Select, c_3_first_hundred)) {
+        std::cout << "index join with inner where clause failed" << std::endl;
+        ok = false;
+    }
+    // b is TEXT, so none of its values can be a key of the index on x: those outer rows are skipped
+    if (ok && !test_index_join(left, nullptr, right, nullptr, "b", just_x, &by_x, EvalPlan::TableScan, 0)) {
+        std::cout << "index join with wrong key type failed" << std::endl;
+        ok = false;
+    }
+    by_x.drop();
+    by_a.drop();
+    return ok;
+}
+
+bool test_eval_plan() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("__test_eval_plan", column_names, column_attributes);
+    table.create();
+    const uint count = 2000;
+    for (uint i = 0; i < count; i++) {
+        ValueDict row;
+        row["a"] = Value((int) i);
+        row["b"] = Value("s" + std::to_string(i % 10));
+        row["c"] = Value((int) i % 7);
+        table.insert(&row);
+    }
+    Handles *handles = table.select();
+    u_long blocks = handles->back().first;
+    delete handles;
+
+    column_names.clear();
+    column_names.push_back("x");
+    column_names.push_back("b");
+    column_names.push_back("v");
+    column_attributes.clear();
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable right("__test_eval_plan_r", column_names, column_attributes);
+    right.create();
+    for (int j = 0; j < 3000; j++) {
+        ValueDict row;
+        row["x"] = Value(j % 2500);
+        row["b"] = Value("r" + std::to_string(j));
+        row["v"] = Value(j);
+        right.insert(&row);
+    }
+
+    bool ok = test_operators(table, count, blocks) && test_index_scans(table) && test_hash_join(table, right) &&
+              test_index_joins(table, right);
+    right.drop();
+    table.drop();
+    return ok;
+}
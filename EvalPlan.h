@@ -11,33 +11,123 @@
 
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
 
+class EvalPlan;
+
+typedef std::vector<EvalPlan *> EvalPlans;
+
+
+/**
+ * @class EvalOperator - Volcano-style iterator; an EvalPlan compiles into a tree of these
+ *
+ * Rows are pulled through the tree one at a time: open() the root, call next() until it
+ * returns nullptr (or until the caller has seen enough), then close() it.
+ */
+class EvalOperator {
+public:
+    virtual ~EvalOperator() {}
+
+    /**
+     * Get ready to produce rows (opens any children).
+     */
+    virtual void open() = 0;
+
+    /**
+     * Produce the next row.
+     * @returns  the next row (freed by caller), or nullptr when there are no more
+     */
+    virtual ValueDict *next() = 0;
+
+    /**
+     * Release any resources held for producing rows (closes any children).
+     */
+    virtual void close() = 0;
+};
+
+
 class EvalPlan {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, TableScan, IndexScan, IndexRange, Union, Join, IndexJoin
     };
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
-    EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select (of equalities; takes over conjunction)
+    EvalPlan(Comparisons *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(Disjunction *disjunction, EvalPlan *relation);  // use for Select with ORs
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbIndex &index, ValueDict *key);  // use for IndexScan
+    EvalPlan(DbIndex &index, ValueDict *min_key, bool min_inclusive, ValueDict *max_key,
+             bool max_inclusive);  // use for IndexRange (nullptr for an open end)
+    EvalPlan(EvalPlans *branches);  // use for Union (of handles from plans over the same table)
+    EvalPlan(EvalPlan *left, EvalPlan *right, ColumnNames *left_keys,
+             ColumnNames *right_keys);  // use for Join (where each left key column equals the right one)
+    EvalPlan(EvalPlan *outer, DbIndex &index, Disjunction *inner_where, ColumnNames *outer_keys,
+             ColumnNames *inner_keys);  // use for IndexJoin (inner_where may be nullptr)
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan, using any of the given indices that help
+    EvalPlan *optimize(const DbIndices *indices = nullptr);
 
-    // Evaluate the plan: evaluate gets values, pipeline gets handles
-    ValueDicts *evaluate();
+    // Evaluate the plan: evaluate gets values (stopping after limit rows, if given), pipeline gets handles. A joined
+    // row comes from two relations, so it has no handle of its own: a plan with a Join in it can only be evaluated.
+    ValueDicts *evaluate(u_long limit = 0);
 
     EvalPipeline pipeline();
 
+    // Turn the plan into a tree of open/next/close operators (freed by caller)
+    EvalOperator *compile();
+
+    // Whether compile() uses batch-at-a-time scans (true by default)
+    static bool vectorized;
+
+    // What kind of plan this is, what it reads from, and its index (e.g., to see what optimize chose)
+    PlanType get_type() const { return type; }
+
+    const EvalPlan *get_relation() const { return relation; }
+
+    const DbIndex *get_index() const { return index; }
+
+    // The table a plan of just one table reads, or nullptr for a Join
+    DbRelation *base_table() const;
+
+    // Most rows a hash join holds in memory from its build side before it partitions its inputs into temporary
+    // files and joins them a partition at a time (100,000 by default)
+    static u_long join_memory;
+
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
+    EvalPlan *relation;  // for everything except TableScan (the left side for Join, the outer side for IndexJoin)
     ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    Disjunction *select_where;  // for Select: conjunctions one of which must hold (for IndexJoin: the inner rows')
+    DbRelation &table;  // for TableScan, IndexScan, and IndexRange (the inner side for IndexJoin)
+    DbIndex *index;  // for IndexScan, IndexRange, and IndexJoin
+    ValueDict *index_key;  // for IndexScan, and the lower bound for IndexRange
+    ValueDict *index_max;  // upper bound for IndexRange
+    bool min_inclusive;  // for IndexRange
+    bool max_inclusive;  // for IndexRange
+    EvalPlans *branches;  // for Union
+    EvalPlan *right;  // for Join
+    ColumnNames *left_keys;  // for Join (the outer side's for IndexJoin)
+    ColumnNames *right_keys;  // for Join (the inner side's for IndexJoin)
+
+    EvalPlan *push_down(const DbIndices *indices) const;
+
+    EvalPlan *index_join(const DbIndices *indices) const;
+
+    static DbIndex *join_index(const DbIndices *indices, const EvalPlan *side, const ColumnNames &keys);
+
+    EvalPipeline union_pipeline();
+
+    static EvalPlan *index_plan(const DbIndices *indices, DbRelation &table, const Comparisons &conjunction);
+
+    static EvalPlan *index_scan(const DbIndices *indices, DbRelation &table, const Comparisons &conjunction);
+
+    static EvalPlan *index_range(const DbIndices *indices, DbRelation &table, const Comparisons &conjunction);
+
+    static DbIndex *choose_index(const DbIndices *indices, const DbRelation &table, const Comparisons *conjunction);
 };
 
+bool test_eval_plan();
@@ -0,0 +1,149 @@
+/**
+ * @file FreeSpaceMap.cpp - implementation of the heap file free-space map
+ * @author Marwa, Ramya
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include "FreeSpaceMap.h"
+
+using namespace std;
+
+// bucket for a number of unused bytes (rounded down, so a block always has at least what its bucket says)
+static u_int8_t to_bucket(u_int16_t unused_bytes) {
+    return (u_int8_t) min(unused_bytes / FreeSpaceMap::BUCKET_BYTES, 255U);
+}
+
+/**
+ * Constructor
+ * @param heap  heap file whose blocks we keep track of
+ * @param name  name of the side file to keep the map in
+ */
+FreeSpaceMap::FreeSpaceMap(HeapFile &heap, string name) : heap(heap), file(name), loaded(false), capacity(1),
+                                                           tree(2, 0), reused_records(0), reclaimed_bytes(0) {
+}
+
+void FreeSpaceMap::create() {
+    this->file.create();
+    load();
+}
+
+void FreeSpaceMap::open() {
+    if (this->loaded)
+        return;
+    try {
+        this->file.open();
+    } catch (DbException &e) {
+        this->file.create();  // never had one (or it was lost) -- load() will rebuild it
+    }
+    load();
+}
+
+void FreeSpaceMap::close() {
+    if (this->loaded)
+        this->file.close();
+    this->loaded = false;
+}
+
+void FreeSpaceMap::drop() {
+    this->loaded = false;
+    try {
+        this->file.drop();
+    } catch (DbException &e) {
+        // the map was never built, so there is nothing to remove
+    }
+}
+
+BlockID FreeSpaceMap::find(u_int16_t size) const {
+    uint needed = max((size + BUCKET_BYTES - 1) / BUCKET_BYTES, 1U);
+    if (!this->loaded || this->tree[1] < needed)
+        return 0;
+    uint node = 1;
+    while (node < this->capacity)
+        node = this->tree[2 * node] >= needed ? 2 * node : 2 * node + 1;  // leftmost subtree with room
+    return node - this->capacity + 1;
+}
+
+void FreeSpaceMap::update(BlockID block_id, u_int16_t unused_bytes) {
+    u_int8_t bucket = to_bucket(unused_bytes);
+    if (block_id <= this->capacity && this->tree[this->capacity + block_id - 1] == bucket)
+        return;
+    set(block_id, bucket);
+    save(block_id, bucket);
+}
+
+/**
+ * Read the buckets from the side file, filling in any that it doesn't know from the heap blocks.
+ */
+void FreeSpaceMap::load() {
+    this->capacity = 1;
+    this->tree.assign(2, 0);
+    BlockID last = this->heap.get_last_block_id();
+    vector<u_int8_t> stored(last, 0);
+    Dbt data;
+    for (BlockID page_id = 1; page_id <= this->file.get_last_block_id(); page_id++) {
+        SlottedPage *page = this->file.get(page_id);
+        if (page->size() > 0 && page->get(1, data)) {
+            const u_int8_t *entries = (const u_int8_t *) data.get_data();
+            BlockID first = (page_id - 1) * ENTRIES_PER_PAGE + 1;
+            for (uint i = 0; i < ENTRIES_PER_PAGE && first + i <= last; i++)
+                stored[first + i - 1] = entries[i];
+        }
+        delete page;
+    }
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        if (stored[block_id - 1] != 0) {
+            set(block_id, (u_int8_t) (stored[block_id - 1] - 1));
+        } else {
+            SlottedPage *block = this->heap.get(block_id);
+            u_int8_t bucket = to_bucket(block->unused_bytes());
+            delete block;
+            set(block_id, bucket);
+            save(block_id, bucket);
+        }
+    }
+    this->loaded = true;
+}
+
+/**
+ * Change a leaf of the in-memory tree (growing the tree if needed) and fix up the maxima above it.
+ * @param block_id  which leaf
+ * @param bucket    its new value
+ */
+void FreeSpaceMap::set(BlockID block_id, u_int8_t bucket) {
+    if (block_id > this->capacity) {
+        uint old_capacity = this->capacity;
+        while (block_id > this->capacity)
+            this->capacity *= 2;
+        vector<u_int8_t> tree(2 * this->capacity, 0);
+        copy(this->tree.begin() + old_capacity, this->tree.end(), tree.begin() + this->capacity);
+        for (uint node = this->capacity - 1; node >= 1; node--)
+            tree[node] = max(tree[2 * node], tree[2 * node + 1]);
+        this->tree.swap(tree);
+    }
+    uint node = this->capacity + block_id - 1;
+    this->tree[node] = bucket;
+    for (node /= 2; node >= 1; node /= 2)
+        this->tree[node] = max(this->tree[2 * node], this->tree[2 * node + 1]);
+}
+
+/**
+ * Write a bucket to the side file (stored plus one, so that zero can mean unknown).
+ * @param block_id  which heap block
+ * @param bucket    its bucket
+ */
+void FreeSpaceMap::save(BlockID block_id, u_int8_t bucket) {
+    BlockID page_id = (block_id - 1) / ENTRIES_PER_PAGE + 1;
+    while (this->file.get_last_block_id() < page_id)
+        delete this->file.get_new();
+    SlottedPage *page = this->file.get(page_id);
+    Dbt data;
+    if (page->size() == 0) {
+        vector<char> unknown(ENTRIES_PER_PAGE, 0);
+        Dbt entries(unknown.data(), ENTRIES_PER_PAGE);
+        page->add(&entries);
+    }
+    page->get(1, data);
+    ((u_int8_t *) data.get_data())[(block_id - 1) % ENTRIES_PER_PAGE] = (u_int8_t) (min((uint) bucket, 254U) + 1);
+    this->file.put(page);
+    delete page;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file FreeSpaceMap.h - Tracks how much room is left in each block of a HeapFile.
+ * FreeSpaceMap
+ *
+ * @author Marwa, Ramya
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "HeapFile.h"
+
+/**
+ * @class FreeSpaceMap - free-space buckets for the blocks of a heap file, kept in a side HeapFile
+ *
+ * Each block's unused bytes are rounded down to a one-byte bucket (BUCKET_BYTES per step). On disk the
+ * buckets are stored ENTRIES_PER_PAGE to a page, as the single record of each page of the side file;
+ * a stored 0 means "not known yet", in which case the heap block is read to find out. So a missing or
+ * partially written map is simply rebuilt from the heap file when it is opened.
+ *
+ * In memory the buckets are the leaves of a max-tree, so finding the lowest-numbered block with room
+ * for a record takes O(log n) rather than a scan of the whole map.
+ */
+class FreeSpaceMap {
+public:
+    static const uint BUCKET_BYTES = 16;
+    static const uint ENTRIES_PER_PAGE = 4000;
+
+    FreeSpaceMap(HeapFile &heap, std::string name);
+
+    virtual ~FreeSpaceMap() {}
+
+    FreeSpaceMap(const FreeSpaceMap &other) = delete;
+
+    FreeSpaceMap &operator=(const FreeSpaceMap &other) = delete;
+
+    /**
+     * Create the side file for a newly created heap file.
+     */
+    virtual void create();
+
+    /**
+     * Open (creating or rebuilding as needed) and load the map. Does nothing if already open.
+     */
+    virtual void open();
+
+    virtual void close();
+
+    /**
+     * Remove the side file (if it was ever created).
+     */
+    virtual void drop();
+
+    /**
+     * Find the lowest-numbered block known to have at least the given number of unused bytes.
+     * @param size  bytes needed (including any slot header)
+     * @returns     a block id, or 0 if no block has room
+     */
+    virtual BlockID find(u_int16_t size) const;
+
+    /**
+     * Record the number of unused bytes now in a block.
+     * @param block_id      block that has changed
+     * @param unused_bytes  its SlottedPage::unused_bytes()
+     */
+    virtual void update(BlockID block_id, u_int16_t unused_bytes);
+
+    /**
+     * Count a record that went into space found through the map rather than at the end of the file.
+     * @param size  size of the record
+     */
+    void reused(u_int16_t size) {
+        reused_records++;
+        reclaimed_bytes += size;
+    }
+
+    u_long get_reused_records() const { return reused_records; }
+
+    u_long get_reclaimed_bytes() const { return reclaimed_bytes; }
+
+protected:
+    HeapFile &heap;
+    HeapFile file;
+    bool loaded;
+    uint capacity;  // number of leaves in the tree (a power of two)
+    std::vector<u_int8_t> tree;  // tree[1] is the root, leaves are tree[capacity ...]
+    u_long reused_records;
+    u_long reclaimed_bytes;
+
+    virtual void load();
+
+    void set(BlockID block_id, u_int8_t bucket);
+
+    void save(BlockID block_id, u_int8_t bucket);
+};
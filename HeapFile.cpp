@@ -18,6 +18,15 @@ HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(
     this->dbfilename = this->name + ".db";
 }
 
+/**
+ * Destructor - make sure none of our blocks are left behind in the buffer pool.
+ */
+HeapFile::~HeapFile() {
+    if (!this->closed)
+        _BUFFER_POOL->flush(this);
+    _BUFFER_POOL->discard(this);
+}
+
 /**
  * Create physical file.
  */
@@ -31,6 +40,7 @@ void HeapFile::create(void) {
  * Delete the physical file.
  */
 void HeapFile::drop(void) {
+    _BUFFER_POOL->discard(this);  // no point writing back blocks of a file we are about to remove
     close();
     Db db(_DB_ENV, 0);
     db.remove(this->dbfilename.c_str(), nullptr, 0);
@@ -47,6 +57,9 @@ void HeapFile::open(void) {
  * Close the physical file.
  */
 void HeapFile::close(void) {
+    if (!this->closed)
+        _BUFFER_POOL->flush(this);
+    _BUFFER_POOL->discard(this);
     this->db.close(0);
     this->closed = true;
 }
@@ -56,19 +69,12 @@ void HeapFile::close(void) {
  * @return the new empty DbBlock that is managing the records in this block and its block id.
  */
 SlottedPage *HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
-
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
+    BlockID block_id = ++this->last;
 
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
-    delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    // the new block only exists in the buffer pool until its frame is written back
+    BufferFrame *frame = _BUFFER_POOL->pin_new(this, block_id);
+    Dbt data(frame->get_data(), DbBlock::BLOCK_SZ);
+    return new SlottedPage(data, block_id, true, frame);
 }
 
 /**
@@ -77,10 +83,9 @@ SlottedPage *HeapFile::get_new(void) {
  * @return          the given slotted page (freed by caller)
  */
 SlottedPage *HeapFile::get(BlockID block_id) {
-    Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, block_id, false);
+    BufferFrame *frame = _BUFFER_POOL->pin(this, block_id);
+    Dbt data(frame->get_data(), DbBlock::BLOCK_SZ);
+    return new SlottedPage(data, block_id, false, frame);
 }
 
 /**
@@ -88,9 +93,7 @@ SlottedPage *HeapFile::get(BlockID block_id) {
  * @param block
  */
 void HeapFile::put(DbBlock *block) {
-    int block_id = block->get_block_id();
-    Dbt key(&block_id, sizeof(block_id));
-    this->db.put(nullptr, &key, block->get_block(), 0);
+    _BUFFER_POOL->write(this, block->get_block_id(), block->get_data());
 }
 
 /**
@@ -104,6 +107,14 @@ BlockIDs *HeapFile::block_ids() const {
     return vec;
 }
 
+/**
+ * Cursor over all the block ids (picks up blocks appended while the cursor is open).
+ * @return new cursor (freed by caller)
+ */
+BlockIDCursor *HeapFile::block_cursor() const {
+    return new HeapFileCursor(*this);
+}
+
 /**
  * Ask BerkDb how many blocks we are currently using in the file.
  * @return number of blocks
@@ -129,3 +140,42 @@ void HeapFile::db_open(uint flags) {
     this->last = flags ? 0 : get_block_count();
     this->closed = false;
 }
+
+/**
+ * Read a block from Berkeley DB (used by the buffer pool on a miss).
+ * @param block_id  which block
+ * @param bytes     where to copy the block's DbBlock::BLOCK_SZ bytes
+ */
+void HeapFile::read_block(BlockID block_id, void *bytes) {
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data;
+    if (this->db.get(nullptr, &key, &data, 0) != 0 || data.get_data() == nullptr)
+        throw DbRelationError("block " + to_string(block_id) + " not found in " + this->dbfilename);
+    u_int32_t size = data.get_size() < DbBlock::BLOCK_SZ ? data.get_size() : DbBlock::BLOCK_SZ;
+    memcpy(bytes, data.get_data(), size);
+    if (size < DbBlock::BLOCK_SZ)
+        memset((char *) bytes + size, 0, DbBlock::BLOCK_SZ - size);
+}
+
+/**
+ * Write a block to Berkeley DB (used by the buffer pool to write back dirty frames).
+ * @param block_id  which block
+ * @param bytes     the block's DbBlock::BLOCK_SZ bytes
+ */
+void HeapFile::write_block(BlockID block_id, const void *bytes) {
+    Dbt key(&block_id, sizeof(block_id));
+    Dbt data((void *) bytes, DbBlock::BLOCK_SZ);
+    this->db.put(nullptr, &key, &data, 0);
+}
+
+/**
+ * Advance to the next block id.
+ * @param block_id  set to the next block id
+ * @return          false if we have already handed out the last block
+ */
+bool HeapFileCursor::next(BlockID &block_id) {
+    if (this->block_id >= this->file.get_last_block_id())
+        return false;
+    block_id = ++this->block_id;
+    return true;
+}
@@ -9,21 +9,23 @@
 
 #include "db_cxx.h"
 #include "SlottedPage.h"
+#include "BufferPool.h"
 
 
 /**
  * @class HeapFile - heap file implementation of DbFile
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one of our
-        database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
-        for buffer management and file management.
+        database blocks for each Berkeley DB record in the RecNo file. Berkeley DB does the file management
+        and the global BufferPool does the buffer management: blocks handed out by get() and get_new() live
+        in pinned buffer frames, and put() just marks the frame dirty until it is written back.
         Uses SlottedPage for storing records within blocks.
  */
 class HeapFile : public DbFile {
 public:
     HeapFile(std::string name);
 
-    virtual ~HeapFile() {}
+    virtual ~HeapFile();
 
     HeapFile(const HeapFile &other) = delete;
 
@@ -49,11 +51,13 @@ public:
 
     virtual BlockIDs *block_ids() const;
 
+    virtual BlockIDCursor *block_cursor() const;
+
     /**
      * Get the id of the current final block in the heap file.
      * @return block id of last block
      */
-    virtual uint32_t get_last_block_id() { return last; }
+    virtual uint32_t get_last_block_id() const { return last; }
 
 protected:
     std::string dbfilename;
@@ -64,5 +68,27 @@ protected:
     virtual void db_open(uint flags = 0);
 
     virtual uint32_t get_block_count();
+
+    // raw Berkeley DB access for the buffer pool
+    virtual void read_block(BlockID block_id, void *bytes);
+
+    virtual void write_block(BlockID block_id, const void *bytes);
+
+    friend class BufferPool;
 };
 
+/**
+ * @class HeapFileCursor - walks the blocks of a HeapFile in order (BlockIDs 1 through the last block)
+ */
+class HeapFileCursor : public BlockIDCursor {
+public:
+    explicit HeapFileCursor(const HeapFile &file) : file(file), block_id(0) {}
+
+    virtual ~HeapFileCursor() {}
+
+    virtual bool next(BlockID &block_id);
+
+protected:
+    const HeapFile &file;
+    BlockID block_id;
+};
@@ -3,8 +3,10 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
 #include <cstring>
 #include "HeapTable.h"
+#include "EvalPlan.h"
 
 using namespace std;
 typedef uint16_t u16;
@@ -16,7 +18,7 @@ typedef uint16_t u16;
  * @param column_attributes
  */
 HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) : DbRelation(
-        table_name, column_names, column_attributes), file(table_name) {
+        table_name, column_names, column_attributes), file(table_name), space(file, table_name + ".fsm") {
 }
 
 /**
@@ -25,6 +27,7 @@ HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttr
  */
 void HeapTable::create() {
     file.create();
+    space.create();
 }
 
 /**
@@ -43,6 +46,7 @@ void HeapTable::create_if_not_exists() {
  * Execute: DROP TABLE <table_name>
  */
 void HeapTable::drop() {
+    space.drop();
     file.drop();
 }
 
@@ -51,12 +55,14 @@ void HeapTable::drop() {
  */
 void HeapTable::open() {
     file.open();
+    space.open();
 }
 
 /**
  * Closes the table. Disables: insert, update, delete, select, project
  */
 void HeapTable::close() {
+    space.close();
     file.close();
 }
 
@@ -97,6 +103,7 @@ void HeapTable::del(const Handle handle) {
     SlottedPage *block = this->file.get(block_id);
     block->del(record_id);
     this->file.put(block);
+    this->space.update(block_id, block->unused_bytes());
     delete block;
 }
 
@@ -105,7 +112,7 @@ void HeapTable::del(const Handle handle) {
  * @return a list of handles for qualifying rows
  */
 Handles *HeapTable::select() {
-    return select(nullptr);
+    return select((const Comparisons *) nullptr);
 }
 
 /**
@@ -114,24 +121,47 @@ Handles *HeapTable::select() {
  * @return list of handles of the selected rows
  */
 Handles *HeapTable::select(const ValueDict *where) {
-    open();
+    if (where == nullptr)
+        return select();
+    Comparisons comparisons = equalities(where);
+    return select(&comparisons);
+}
+
+/**
+ * The select command, with any kind of comparisons
+ * @param where predicates to match (nullptr for all rows)
+ * @return list of handles of the selected rows
+ */
+Handles *HeapTable::select(const Comparisons *where) {
     Handles *handles = new Handles();
-    BlockIDs *block_ids = file.block_ids();
-    for (auto const &block_id: *block_ids) {
-        SlottedPage *block = file.get(block_id);
-        RecordIDs *record_ids = block->ids();
-        for (auto const &record_id: *record_ids) {
-            Handle handle(block_id, record_id);
-            if (selected(handle, where))
-                handles->push_back(handle);
-        }
-        delete record_ids;
-        delete block;
-    }
-    delete block_ids;
+    HandleCursor *rows = cursor(where);
+    Handle handle;
+    while (rows->next(handle))
+        handles->push_back(handle);
+    delete rows;
     return handles;
 }
 
+/**
+ * Streaming version of select.
+ * @param where predicates to match (must outlive the cursor)
+ * @return      cursor over handles of the selected rows (freed by caller)
+ */
+HandleCursor *HeapTable::cursor(const ValueDict *where) {
+    open();
+    return new HeapTableCursor(*this, where);
+}
+
+/**
+ * Streaming version of select, with any kind of comparisons.
+ * @param where predicates to match (compiled right away, so they needn't outlive the cursor)
+ * @return      cursor over handles of the selected rows (freed by caller)
+ */
+HandleCursor *HeapTable::cursor(const Comparisons *where) {
+    open();
+    return new HeapTableCursor(*this, where);
+}
+
 /**
  * Refine another selection
  *
@@ -140,13 +170,102 @@ Handles *HeapTable::select(const ValueDict *where) {
  * @return                  list of handles of the selected rows
  */
 Handles *HeapTable::select(Handles *current_selection, const ValueDict *where) {
+    if (where == nullptr)
+        return select(current_selection, (const Comparisons *) nullptr);
+    Comparisons comparisons = equalities(where);
+    return select(current_selection, &comparisons);
+}
+
+/**
+ * Refine another selection, with any kind of comparisons
+ *
+ * @param current_selection range of handles to filter
+ * @param where             predicates to match
+ * @return                  list of handles of the selected rows
+ */
+Handles *HeapTable::select(Handles *current_selection, const Comparisons *where) {
+    if (where == nullptr)
+        return new Handles(*current_selection);
+    RecordPredicate *predicate = compile(where);
+    Handles *handles = refine(current_selection, *predicate);
+    delete predicate;
+    return handles;
+}
+
+/**
+ * The select command, for a where clause with ORs (checking each row against all the conjunctions at once)
+ * @param where conjunctions one of which must hold (nullptr for all rows)
+ * @return list of handles of the selected rows
+ */
+Handles *HeapTable::select(const Disjunction *where) {
     Handles *handles = new Handles();
-    for (auto const &handle: *current_selection)
-        if (selected(handle, where))
+    HandleCursor *rows = cursor(where);
+    Handle handle;
+    while (rows->next(handle))
+        handles->push_back(handle);
+    delete rows;
+    return handles;
+}
+
+/**
+ * Streaming version of select, for a where clause with ORs.
+ * @param where conjunctions one of which must hold (compiled right away, so they needn't outlive the cursor)
+ * @return      cursor over handles of the selected rows (freed by caller)
+ */
+HandleCursor *HeapTable::cursor(const Disjunction *where) {
+    open();
+    return new HeapTableCursor(*this, where);
+}
+
+/**
+ * Refine another selection, for a where clause with ORs
+ *
+ * @param current_selection range of handles to filter
+ * @param where             conjunctions one of which must hold
+ * @return                  list of handles of the selected rows
+ */
+Handles *HeapTable::select(Handles *current_selection, const Disjunction *where) {
+    if (where == nullptr)
+        return new Handles(*current_selection);
+    RecordPredicate *predicate = compile(where);
+    Handles *handles = refine(current_selection, *predicate);
+    delete predicate;
+    return handles;
+}
+
+/**
+ * The handles of a selection whose rows pass a compiled predicate, reading each block once for a run of handles
+ * into it.
+ * @param current_selection  handles to check
+ * @param predicate          compiled where clause
+ * @return                   list of handles that pass
+ */
+Handles *HeapTable::refine(Handles *current_selection, const RecordPredicate &predicate) {
+    Handles *handles = new Handles();
+    SlottedPage *block = nullptr;
+    Dbt data;
+    for (auto const &handle: *current_selection) {
+        if (block == nullptr || block->get_block_id() != handle.first) {
+            delete block;
+            block = this->file.get(handle.first);
+        }
+        if (block->get(handle.second, data) && predicate.matches((const char *) data.get_data()))
             handles->push_back(handle);
+    }
+    delete block;
     return handles;
 }
 
+/**
+ * Read the table into column-oriented batches.
+ * @param column_names  columns to decode into the batches (must outlive the cursor)
+ * @return              batch cursor (freed by caller)
+ */
+BatchCursor *HeapTable::batch_cursor(const ColumnNames *column_names) {
+    open();
+    return new HeapTableBatchCursor(*this, column_names);
+}
+
 /**
  * Project all columns from a given row.
  * @param handle row to be projected
@@ -166,20 +285,61 @@ ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = file.get(block_id);
-    Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    delete data;
+    Dbt data;
+    if (!block->get(record_id, data)) {
+        delete block;
+        throw DbRelationError("no row for the given handle");
+    }
+    ValueDict *row;
+    try {
+        row = column_names->empty() ? unmarshal(&data) : unmarshal(&data, column_names);
+    } catch (DbRelationError &e) {
+        delete block;
+        throw;
+    }
     delete block;
-    if (column_names->empty())
-        return row;
-    ValueDict *result = new ValueDict();
-    for (auto const &column_name: *column_names) {
-        if (row->find(column_name) == row->end())
-            throw DbRelationError("table does not have column named '" + column_name + "'");
-        (*result)[column_name] = (*row)[column_name];
+    return row;
+}
+
+/**
+ * Project given columns from many rows, reading each block only once. The handles are visited in block
+ * order (ties keep their original order) but the results come back in the order of the handles.
+ * @param handles       rows to be projected
+ * @param column_names  columns to be included in the results
+ * @return              one row of values per handle (freed by caller)
+ */
+ValueDicts *HeapTable::project(Handles *handles, const ColumnNames *column_names) {
+    vector<uint> order(handles->size());
+    for (uint i = 0; i < order.size(); i++)
+        order[i] = i;
+    auto by_block = [handles](uint a, uint b) { return (*handles)[a].first < (*handles)[b].first; };
+    if (!is_sorted(order.begin(), order.end(), by_block))
+        stable_sort(order.begin(), order.end(), by_block);
+
+    ValueDicts *ret = new ValueDicts(handles->size(), nullptr);
+    SlottedPage *block = nullptr;
+    Dbt data;
+    try {
+        for (auto const &i: order) {
+            Handle handle = (*handles)[i];
+            if (block == nullptr || block->get_block_id() != handle.first) {
+                delete block;
+                block = nullptr;
+                block = this->file.get(handle.first);
+            }
+            if (!block->get(handle.second, data))
+                throw DbRelationError("no row for the given handle");
+            (*ret)[i] = column_names->empty() ? unmarshal(&data) : unmarshal(&data, column_names);
+        }
+    } catch (DbRelationError &e) {
+        delete block;
+        for (auto row: *ret)
+            delete row;
+        delete ret;
+        throw;
     }
-    delete row;
-    return result;
+    delete block;
+    return ret;
 }
 
 /**
@@ -203,27 +363,42 @@ ValueDict *HeapTable::validate(const ValueDict *row) const {
 }
 
 /**
- * Appends a record to the file.
+ * Appends a record to the file, in the first block the free-space map says has room for it
+ * (or in a new block if none does).
  * @param row to be appended
  * @return handle of newly inserted row
  */
 Handle HeapTable::append(const ValueDict *row) {
     Dbt *data = marshal(row);
-    SlottedPage *block = this->file.get(this->file.get_last_block_id());
-    RecordID record_id;
-    try {
-        record_id = block->add(data);
-    } catch (DbBlockNoRoomError &e) {
+    u16 size = (u16) data->get_size();
+    SlottedPage *block = nullptr;
+    RecordID record_id = 0;
+    BlockID block_id;
+    while (record_id == 0 && (block_id = this->space.find(size + 4)) != 0) {  // record plus its header
+        block = this->file.get(block_id);
+        try {
+            record_id = block->add(data);
+            if (block_id < this->file.get_last_block_id())
+                this->space.reused(size);
+        } catch (DbBlockNoRoomError &e) {
+            // the map was out of date for this block -- fix it and look again
+            this->space.update(block_id, block->unused_bytes());
+            delete block;
+            block = nullptr;
+        }
+    }
+    if (record_id == 0) {
         // need a new block
-        delete block;
         block = this->file.get_new();
         record_id = block->add(data);
     }
     this->file.put(block);
+    this->space.update(block->get_block_id(), block->unused_bytes());
+    Handle handle(block->get_block_id(), record_id);
     delete block;
     delete[] (char *) data->get_data();
     delete data;
-    return Handle(this->file.get_last_block_id(), record_id);
+    return handle;
 }
 
 /**
@@ -292,10 +467,7 @@ ValueDict *HeapTable::unmarshal(Dbt *data) const {
         } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
             u16 size = *(u16 *) (bytes + offset);
             offset += sizeof(u16);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = string(buffer);  // assume ascii for now
+            value.s.assign(bytes + offset, size);  // assume ascii for now
             offset += size;
         } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t *) (bytes + offset);
@@ -308,6 +480,91 @@ ValueDict *HeapTable::unmarshal(Dbt *data) const {
     return row;
 }
 
+/**
+ * Figure out just some of the columns from the given bits gotten from the file. The columns that aren't
+ * wanted are skipped over (TEXT by its length prefix) and decoding stops after the last wanted one.
+ * @param data          file data for the tuple
+ * @param column_names  columns to decode
+ * @return              row data for those columns of the tuple
+ */
+ValueDict *HeapTable::unmarshal(Dbt *data, const ColumnNames *column_names) const {
+    vector<bool> wanted(this->column_names.size(), false);
+    uint end = 0;
+    for (auto const &column_name: *column_names) {
+        auto it = find(this->column_names.begin(), this->column_names.end(), column_name);
+        if (it == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        uint col_num = (uint) (it - this->column_names.begin());
+        wanted[col_num] = true;
+        if (col_num + 1 > end)
+            end = col_num + 1;
+    }
+
+    ValueDict *row = new ValueDict();
+    const char *bytes = (const char *) data->get_data();
+    uint offset = 0;
+    for (uint col_num = 0; col_num < end; col_num++) {
+        ColumnAttribute::DataType data_type = ColumnAttribute(this->column_attributes[col_num]).get_data_type();
+        if (data_type == ColumnAttribute::DataType::INT) {
+            if (wanted[col_num])
+                (*row)[this->column_names[col_num]] = Value(*(int32_t *) (bytes + offset));
+            offset += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16 *) (bytes + offset);
+            offset += sizeof(u16);
+            if (wanted[col_num])
+                (*row)[this->column_names[col_num]] = Value(string(bytes + offset, size));
+            offset += size;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            if (wanted[col_num]) {
+                Value &value = (*row)[this->column_names[col_num]];
+                value.data_type = data_type;
+                value.n = *(uint8_t *) (bytes + offset);
+            }
+            offset += sizeof(uint8_t);
+        } else {
+            delete row;
+            throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+        }
+    }
+    return row;
+}
+
+/**
+ * Decode a record directly into the next row of a batch, skipping the columns the batch doesn't want.
+ * @param bytes  the record as stored in the block
+ * @param batch  batch whose columns get the values (the caller has already added the row's handle)
+ * @param slots  for each column of the table, its index in the batch or -1 to skip it
+ */
+void HeapTable::unmarshal(const char *bytes, RowBatch &batch, const std::vector<int> &slots) const {
+    uint offset = 0;
+    for (uint col_num = 0; col_num < this->column_attributes.size(); col_num++) {
+        ColumnAttribute::DataType data_type = ColumnAttribute(this->column_attributes[col_num]).get_data_type();
+        int slot = slots[col_num];
+        if (data_type == ColumnAttribute::DataType::INT) {
+            if (slot >= 0)
+                batch.column(slot).ints.push_back(*(int32_t *) (bytes + offset));
+            offset += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16 *) (bytes + offset);
+            offset += sizeof(u16);
+            if (slot >= 0) {
+                ColumnVector &column = batch.column(slot);
+                column.offsets.push_back((u_int32_t) column.text.size());
+                column.lengths.push_back(size);
+                column.text.append(bytes + offset, size);
+            }
+            offset += size;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            if (slot >= 0)
+                batch.column(slot).bools.push_back(*(uint8_t *) (bytes + offset));
+            offset += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+        }
+    }
+}
+
 /**
  * See if the row at the given handle satisfies the given where clause
  * @param handle  row to check
@@ -317,12 +574,328 @@ ValueDict *HeapTable::unmarshal(Dbt *data) const {
 bool HeapTable::selected(Handle handle, const ValueDict *where) {
     if (where == nullptr)
         return true;
-    ValueDict *row = this->project(handle, where);
-    bool is_selected = *row == *where;
-    delete row;
+    RecordPredicate *predicate = compile(where);
+    SlottedPage *block = this->file.get(handle.first);
+    Dbt data;
+    bool is_selected = block->get(handle.second, data) && predicate->matches((const char *) data.get_data());
+    delete block;
+    delete predicate;
     return is_selected;
 }
 
+/**
+ * Compile a where clause against this table's schema.
+ * @param where  conditions to check
+ * @return       predicate to run on marshalled records (freed by caller)
+ */
+RecordPredicate *HeapTable::compile(const ValueDict *where) const {
+    return new RecordPredicate(this->column_names, this->column_attributes, where);
+}
+
+RecordPredicate *HeapTable::compile(const Comparisons *where) const {
+    return new RecordPredicate(this->column_names, this->column_attributes,
+                               where == nullptr ? Comparisons() : *where);
+}
+
+RecordPredicate *HeapTable::compile(const Disjunction *where) const {
+    if (where == nullptr)
+        return compile((const Comparisons *) nullptr);
+    return new RecordPredicate(this->column_names, this->column_attributes, *where);
+}
+
+/**
+ * Constructor
+ * @param column_names       the table's columns
+ * @param column_attributes  their data types
+ * @param where              conditions to check
+ * @throws                   DbRelationError if a condition names a column the table doesn't have
+ */
+RecordPredicate::RecordPredicate(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                                 const Comparisons &where) : data_types(), terms() {
+    for (auto const &column_attribute: column_attributes)
+        this->data_types.push_back(ColumnAttribute(column_attribute).get_data_type());
+    add_term(column_names, where);
+}
+
+/**
+ * Constructor for a where clause with ORs
+ * @param column_names       the table's columns
+ * @param column_attributes  their data types
+ * @param where              conjunctions one of which must hold
+ * @throws                   DbRelationError if a condition names a column the table doesn't have
+ */
+RecordPredicate::RecordPredicate(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                                 const Disjunction &where) : data_types(), terms() {
+    for (auto const &column_attribute: column_attributes)
+        this->data_types.push_back(ColumnAttribute(column_attribute).get_data_type());
+    for (auto const &conjunction: where)
+        add_term(column_names, conjunction);
+}
+
+// Compile a conjunction into tests sorted by column; one that can't hold (e.g., a value of the wrong data type
+// for its column) is left out, since it never matches anything.
+void RecordPredicate::add_term(const ColumnNames &column_names, const Comparisons &conjunction) {
+    std::vector<ColumnTest> tests;
+    bool never = false;
+    for (auto const &predicate: conjunction) {
+        auto it = find(column_names.begin(), column_names.end(), predicate.column_name);
+        if (it == column_names.end())
+            throw DbRelationError("table does not have column named '" + predicate.column_name + "'");
+        ColumnTest test;
+        test.col_num = (uint) (it - column_names.begin());
+        test.op = predicate.op;
+        test.n = predicate.value.n;
+        test.s = predicate.value.s;
+        ColumnAttribute::DataType data_type = this->data_types[test.col_num];
+        if (predicate.op == Comparison::IN) {
+            for (auto const &value: predicate.values)
+                if (value.data_type == data_type)
+                    test.values.push_back(value);
+            if (test.values.empty())
+                never = true;
+        } else if (predicate.value.data_type != data_type) {
+            never = true;  // values of different types never compare
+        }
+        tests.push_back(test);
+    }
+    if (never)
+        return;
+    sort(tests.begin(), tests.end(),
+         [](const ColumnTest &a, const ColumnTest &b) { return a.col_num < b.col_num; });
+    this->terms.push_back(tests);
+}
+
+bool RecordPredicate::matches(const char *bytes) const {
+    for (auto const &tests: this->terms)
+        if (matches(bytes, tests))
+            return true;
+    return false;
+}
+
+// Whether every one of a conjunction's tests holds.
+bool RecordPredicate::matches(const char *bytes, const std::vector<ColumnTest> &tests) const {
+    uint offset = 0;
+    uint col_num = 0;
+    for (auto const &test: tests) {
+        // skip over the columns in between
+        for (; col_num < test.col_num; col_num++) {
+            ColumnAttribute::DataType data_type = this->data_types[col_num];
+            if (data_type == ColumnAttribute::DataType::INT)
+                offset += sizeof(int32_t);
+            else if (data_type == ColumnAttribute::DataType::TEXT)
+                offset += sizeof(u16) + *(u16 *) (bytes + offset);
+            else
+                offset += sizeof(uint8_t);
+        }
+        ColumnAttribute::DataType data_type = this->data_types[col_num];
+        if (test.op == Comparison::IN) {
+            if (!in(bytes + offset, data_type, test.values))
+                return false;
+            continue;
+        }
+        int cmp;
+        if (data_type == ColumnAttribute::DataType::INT) {
+            int32_t n = *(int32_t *) (bytes + offset);
+            cmp = n < test.n ? -1 : (n > test.n ? 1 : 0);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16 *) (bytes + offset);
+            const char *s = bytes + offset + sizeof(u16);
+            if (test.op == Comparison::EQ) {
+                if (size != test.s.size() || memcmp(s, test.s.data(), size) != 0)
+                    return false;
+                continue;
+            }
+            cmp = memcmp(s, test.s.data(), min((size_t) size, test.s.size()));
+            if (cmp == 0)
+                cmp = (int) size - (int) test.s.size();
+        } else {
+            cmp = (int) *(uint8_t *) (bytes + offset) - (int) (uint8_t) test.n;
+        }
+        if (!Comparison::holds(test.op, cmp))
+            return false;
+    }
+    return true;
+}
+
+// Whether a marshalled field equals any of the values (all of the field's data type).
+bool RecordPredicate::in(const char *field, ColumnAttribute::DataType data_type, const std::vector<Value> &values) {
+    if (data_type == ColumnAttribute::DataType::INT) {
+        int32_t n = *(int32_t *) field;
+        for (auto const &value: values)
+            if (value.n == n)
+                return true;
+    } else if (data_type == ColumnAttribute::DataType::TEXT) {
+        u16 size = *(u16 *) field;
+        for (auto const &value: values)
+            if (size == value.s.size() && memcmp(field + sizeof(u16), value.s.data(), size) == 0)
+                return true;
+    } else {
+        uint8_t b = *(uint8_t *) field;
+        for (auto const &value: values)
+            if ((uint8_t) value.n == b)
+                return true;
+    }
+    return false;
+}
+
+/**
+ * Constructor
+ * @param table  table to scan
+ * @param where  predicates rows must match (nullptr for all rows)
+ */
+HeapTableCursor::HeapTableCursor(HeapTable &table, const ValueDict *where) : table(table),
+                                                                             predicate(nullptr),
+                                                                             block_ids(nullptr),
+                                                                             block(nullptr), record_ids(nullptr),
+                                                                             position(0) {
+    if (where != nullptr)
+        this->predicate = table.compile(where);
+    this->block_ids = table.file.block_cursor();
+}
+
+/**
+ * Constructor
+ * @param table  table to scan
+ * @param where  comparisons rows must match (nullptr for all rows)
+ */
+HeapTableCursor::HeapTableCursor(HeapTable &table, const Comparisons *where) : table(table),
+                                                                               predicate(nullptr),
+                                                                               block_ids(nullptr),
+                                                                               block(nullptr), record_ids(nullptr),
+                                                                               position(0) {
+    if (where != nullptr)
+        this->predicate = table.compile(where);
+    this->block_ids = table.file.block_cursor();
+}
+
+/**
+ * Constructor
+ * @param table  table to scan
+ * @param where  conjunctions one of which rows must match (nullptr for all rows)
+ */
+HeapTableCursor::HeapTableCursor(HeapTable &table, const Disjunction *where) : table(table),
+                                                                               predicate(nullptr),
+                                                                               block_ids(nullptr),
+                                                                               block(nullptr), record_ids(nullptr),
+                                                                               position(0) {
+    if (where != nullptr)
+        this->predicate = table.compile(where);
+    this->block_ids = table.file.block_cursor();
+}
+
+HeapTableCursor::~HeapTableCursor() {
+    release_block();
+    delete this->block_ids;
+    delete this->predicate;
+}
+
+/**
+ * Get the next qualifying row, reading the next block in when the current one is used up.
+ * @param handle  set to the handle of the next qualifying row
+ * @return        false if there are no more qualifying rows
+ */
+bool HeapTableCursor::next(Handle &handle) {
+    Dbt data;
+    while (true) {
+        if (this->block != nullptr) {
+            BlockID block_id = this->block->get_block_id();
+            while (this->position < this->record_ids->size()) {
+                RecordID record_id = (*this->record_ids)[this->position++];
+                if (this->predicate == nullptr ||
+                    (this->block->get(record_id, data) && this->predicate->matches((const char *) data.get_data()))) {
+                    handle = Handle(block_id, record_id);
+                    return true;
+                }
+            }
+            release_block();
+        }
+        BlockID block_id;
+        if (!this->block_ids->next(block_id))
+            return false;
+        this->block = this->table.file.get(block_id);
+        this->record_ids = this->block->ids();
+        this->position = 0;
+    }
+}
+
+// Let go of the current block.
+void HeapTableCursor::release_block() {
+    delete this->record_ids;
+    this->record_ids = nullptr;
+    delete this->block;
+    this->block = nullptr;
+}
+
+/**
+ * Constructor
+ * @param table         table to scan
+ * @param column_names  columns to decode into each batch (each just once)
+ */
+HeapTableBatchCursor::HeapTableBatchCursor(HeapTable &table, const ColumnNames *column_names) : table(table),
+                                                                                               slots(table.column_names.size(),
+                                                                                                     -1),
+                                                                                               block_ids(table.file.block_cursor()),
+                                                                                               block(nullptr),
+                                                                                               record_ids(nullptr),
+                                                                                               position(0) {
+    for (uint i = 0; i < column_names->size(); i++) {
+        auto it = find(table.column_names.begin(), table.column_names.end(), (*column_names)[i]);
+        if (it == table.column_names.end()) {
+            delete this->block_ids;
+            throw DbRelationError("table does not have column named '" + (*column_names)[i] + "'");
+        }
+        if (this->slots[it - table.column_names.begin()] >= 0) {
+            delete this->block_ids;
+            throw DbRelationError("column '" + (*column_names)[i] + "' is in the batch twice");
+        }
+        this->slots[it - table.column_names.begin()] = (int) i;
+    }
+}
+
+HeapTableBatchCursor::~HeapTableBatchCursor() {
+    release_block();
+    delete this->block_ids;
+}
+
+/**
+ * Refill the batch with the next records, reading blocks in as needed.
+ * @param batch  batch to fill
+ * @return       false if the table has been exhausted
+ */
+bool HeapTableBatchCursor::next(RowBatch &batch) {
+    batch.clear();
+    Dbt data;
+    while (!batch.full()) {
+        if (this->block == nullptr) {
+            BlockID block_id;
+            if (!this->block_ids->next(block_id))
+                break;
+            this->block = this->table.file.get(block_id);
+            this->record_ids = this->block->ids();
+            this->position = 0;
+        }
+        BlockID block_id = this->block->get_block_id();
+        while (this->position < this->record_ids->size() && !batch.full()) {
+            RecordID record_id = (*this->record_ids)[this->position++];
+            if (!this->block->get(record_id, data))
+                continue;
+            batch.add_row(Handle(block_id, record_id));
+            this->table.unmarshal((const char *) data.get_data(), batch, this->slots);
+        }
+        if (this->position >= this->record_ids->size())
+            release_block();
+    }
+    return batch.size() > 0;
+}
+
+// Let go of the current block.
+void HeapTableBatchCursor::release_block() {
+    delete this->record_ids;
+    this->record_ids = nullptr;
+    delete this->block;
+    this->block = nullptr;
+}
+
 /**
  * Test helper. Sets the row's a and b values.
  * @param row to set
@@ -371,6 +944,9 @@ bool test_heap_storage() {
     if (!test_slotted_page())
         return assertion_failure("slotted page tests failed");
     cout << endl << "slotted page tests ok" << endl;
+    if (!test_buffer_pool())
+        return assertion_failure("buffer pool tests failed");
+    cout << "buffer pool tests ok" << endl;
 
     ColumnNames column_names;
     column_names.push_back("a");
@@ -402,6 +978,14 @@ bool test_heap_storage() {
     Handles *handles = table.select();
     if (!test_compare(table, (*handles)[0], -1, b))
         return false;
+    ColumnNames narrow;
+    narrow.push_back("c");
+    narrow.push_back("a");
+    ValueDict *result = table.project((*handles)[0], &narrow);
+    bool narrowed = result->size() == 2 && (*result)["a"] == Value(-1) && result->find("b") == result->end();
+    delete result;
+    if (!narrowed)
+        return false;
     cout << "select/project ok " << handles->size() << endl;
     delete handles;
 
@@ -419,6 +1003,113 @@ bool test_heap_storage() {
             return false;
     }
     cout << "many inserts/select/projects ok" << endl;
+
+    HandleCursor *rows = table.cursor();
+    Handle handle;
+    u_long count = 0;
+    while (rows->next(handle))
+        if (handle != (*handles)[count++])
+            return false;
+    delete rows;
+    if (count != handles->size())
+        return false;
+    ValueDict where;
+    where["a"] = Value(500);
+    rows = table.cursor(&where);
+    if (!rows->next(handle) || !test_compare(table, handle, 500, b) || rows->next(handle))
+        return false;
+    delete rows;
+    Handles reversed(handles->rbegin(), handles->rend());
+    u_long pins = _BUFFER_POOL->get_misses() + _BUFFER_POOL->get_hits();
+    ValueDicts *results = table.project(&reversed);
+    bool in_order = results->size() == reversed.size() && (*results->front())["a"] == Value(999) &&
+                    (*results->back())["a"] == Value(-1);
+    u_long fetches = _BUFFER_POOL->get_misses() + _BUFFER_POOL->get_hits() - pins;
+    for (auto result: *results)
+        delete result;
+    delete results;
+    if (!in_order || fetches > handles->back().first)  // one fetch per block
+        return false;
+    where["b"] = Value(b);
+    Handles *some = table.select(&where);
+    bool found = some->size() == 1 && (*some)[0] == (*handles)[501];
+    delete some;
+    if (!found)
+        return false;
+    where["b"] = Value(b + "!");
+    some = table.select(handles, &where);
+    found = !some->empty();
+    delete some;
+    if (found)
+        return false;
+    where.erase("b");
+    Comparisons range;
+    range.push_back(Comparison("a", Comparison::GT, Value(990)));
+    range.push_back(Comparison("a", Comparison::LE, Value(995)));
+    some = table.select(&range);
+    found = some->size() == 5 && (*some)[0] == (*handles)[992] && (*some)[4] == (*handles)[996];
+    delete some;
+    if (!found)
+        return false;
+    std::vector<Value> values;
+    values.push_back(Value(3));
+    values.push_back(Value(992));
+    Disjunction any(1, range);
+    any.push_back(Comparisons(1, Comparison("a", values)));
+    some = table.select(&any);
+    found = some->size() == 6 && (*some)[0] == (*handles)[4] && (*some)[1] == (*handles)[992];
+    delete some;
+    if (!found)
+        return false;
+    cout << "cursor ok" << endl;
+
+    ColumnNames batch_columns;
+    batch_columns.push_back("b");
+    batch_columns.push_back("a");
+    ColumnAttributes *batch_attributes = table.get_column_attributes(batch_columns);
+    RowBatch batch(batch_columns, *batch_attributes);
+    delete batch_attributes;
+    BatchCursor *batches = table.batch_cursor(&batch_columns);
+    count = 0;
+    while (batches->next(batch)) {
+        batch.select_all();
+        batch.filter(&where);
+        for (auto const &row: batch.get_selection())
+            if (batch.get_handle(row) != (*handles)[501] || batch.column(0).get(row).s != b)
+                return false;
+        count += batch.get_selection().size();
+    }
+    delete batches;
+    if (count != 1)
+        return false;
+    // a projection that repeats a column copies it from the batch's one slot for it
+    ColumnNames repeated;
+    repeated.push_back("b");
+    repeated.push_back("a");
+    repeated.push_back("b");
+    for (int vectorized = 0; vectorized < 2; vectorized++) {
+        EvalPlan::vectorized = vectorized == 1;
+        EvalPlan scan(new ColumnNames(repeated), new EvalPlan(table));
+        ValueDicts *rows = scan.evaluate();
+        bool repeats = rows->size() == 1001;
+        for (auto result: *rows) {
+            repeats = repeats && result->size() == 2 && result->at("b").s.size() >= b.size();
+            delete result;
+        }
+        delete rows;
+        ValueDict *equal = new ValueDict();
+        (*equal)["a"] = Value(500);
+        EvalPlan select(new ColumnNames(2, "b"), new EvalPlan(equal, new EvalPlan(table)));
+        rows = select.evaluate();
+        repeats = repeats && rows->size() == 1 && rows->front()->size() == 1 && rows->front()->at("b").s == b;
+        for (auto result: *rows)
+            delete result;
+        delete rows;
+        if (!repeats)
+            return false;
+    }
+    EvalPlan::vectorized = true;
+    cout << "batch cursor ok" << endl;
     delete handles;
 
     table.del(last_handle);
@@ -431,6 +1122,25 @@ bool test_heap_storage() {
             return false;
     }
     cout << "del ok" << endl;
+
+    // space freed by deletes gets reused, even after reopening the table
+    for (int j = 10; j < 20; j++)
+        table.del((*handles)[j]);
+    for (int j = 0; j < 10; j++) {
+        test_set_row(row, 2000 + j, b);
+        if (table.insert(&row).first != (*handles)[10].first)
+            return false;
+    }
+    if (table.get_free_space_map().get_reused_records() != 10 ||
+        table.get_free_space_map().get_reclaimed_bytes() == 0)
+        return false;
+    table.close();
+    table.open();
+    table.del((*handles)[500]);
+    test_set_row(row, 3000, b);
+    if (table.insert(&row).first != (*handles)[500].first)
+        return false;
+    cout << "free space map ok" << endl;
     table.drop();
     delete handles;
     return true;
@@ -10,6 +10,56 @@
 #include "storage_engine.h"
 #include "SlottedPage.h"
 #include "HeapFile.h"
+#include "FreeSpaceMap.h"
+#include "RowBatch.h"
+
+/**
+ * @class RecordPredicate - a where clause compiled against a table's schema
+ *
+ * Each predicate becomes a test on one column number, sorted by column, so a marshalled record can be
+ * checked by walking its bytes once (skipping TEXT fields by their length prefix) and comparing in
+ * place: memcmp for TEXT, integer compare for INT and BOOLEAN. Nothing is allocated per record.
+ * A where clause with ORs compiles each of its conjunctions this way, and a record matches if any of them does.
+ */
+class RecordPredicate {
+public:
+    RecordPredicate(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                    const Comparisons &where);
+
+    RecordPredicate(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                    const ValueDict *where) : RecordPredicate(column_names, column_attributes, equalities(where)) {}
+
+    RecordPredicate(const ColumnNames &column_names, const ColumnAttributes &column_attributes,
+                    const Disjunction &where);
+
+    virtual ~RecordPredicate() {}
+
+    /**
+     * Check a record as it is stored in its block.
+     * @param bytes  the marshalled record
+     * @returns      true if every predicate of one of the conjunctions holds
+     */
+    bool matches(const char *bytes) const;
+
+protected:
+    struct ColumnTest {
+        uint col_num;
+        Comparison::Op op;
+        int32_t n;
+        std::string s;
+        std::vector<Value> values;  // for IN
+    };
+
+    std::vector<ColumnAttribute::DataType> data_types;
+    std::vector<std::vector<ColumnTest>> terms;  // the tests of each conjunction that can hold
+
+    void add_term(const ColumnNames &column_names, const Comparisons &conjunction);
+
+    bool matches(const char *bytes, const std::vector<ColumnTest> &tests) const;
+
+    static bool in(const char *field, ColumnAttribute::DataType data_type, const std::vector<Value> &values);
+};
+
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
@@ -51,14 +101,39 @@ public:
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual HandleCursor *cursor(const ValueDict *where = nullptr);
+
+    virtual Handles *select(const Comparisons *where);
+
+    virtual Handles *select(Handles *current_selection, const Comparisons *where);
+
+    virtual HandleCursor *cursor(const Comparisons *where);
+
+    virtual Handles *select(const Disjunction *where);
+
+    virtual Handles *select(Handles *current_selection, const Disjunction *where);
+
+    virtual HandleCursor *cursor(const Disjunction *where);
+
+    virtual BatchCursor *batch_cursor(const ColumnNames *column_names);
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
+    virtual ValueDicts *project(Handles *handles, const ColumnNames *column_names);
+
     using DbRelation::project;
 
+    /**
+     * Accessor for the free-space map (e.g., to see how much space has been reclaimed).
+     * @returns  the table's free-space map
+     */
+    const FreeSpaceMap &get_free_space_map() const { return space; }
+
 protected:
     HeapFile file;
+    FreeSpaceMap space;
 
     virtual ValueDict *validate(const ValueDict *row) const;
 
@@ -68,8 +143,84 @@ protected:
 
     virtual ValueDict *unmarshal(Dbt *data) const;
 
+    virtual ValueDict *unmarshal(Dbt *data, const ColumnNames *column_names) const;
+
+    virtual void unmarshal(const char *bytes, RowBatch &batch, const std::vector<int> &slots) const;
+
     virtual bool selected(Handle handle, const ValueDict *where);
+
+    virtual RecordPredicate *compile(const ValueDict *where) const;
+
+    virtual RecordPredicate *compile(const Comparisons *where) const;
+
+    virtual RecordPredicate *compile(const Disjunction *where) const;
+
+    Handles *refine(Handles *current_selection, const RecordPredicate &predicate);
+
+    friend class HeapTableCursor;
+
+    friend class HeapTableBatchCursor;
 };
 
-bool test_heap_storage();
 
+/**
+ * @class HeapTableCursor - streams the qualifying handles of a HeapTable one block at a time
+ *
+ * Only the current block (and its list of record ids) is held at any time, so memory use does not
+ * depend on the size of the table and the first row is available as soon as the first block is read.
+ */
+class HeapTableCursor : public HandleCursor {
+public:
+    HeapTableCursor(HeapTable &table, const ValueDict *where);
+
+    HeapTableCursor(HeapTable &table, const Comparisons *where);
+
+    HeapTableCursor(HeapTable &table, const Disjunction *where);
+
+    virtual ~HeapTableCursor();
+
+    HeapTableCursor(const HeapTableCursor &other) = delete;
+
+    HeapTableCursor &operator=(const HeapTableCursor &other) = delete;
+
+    virtual bool next(Handle &handle);
+
+protected:
+    HeapTable &table;
+    RecordPredicate *predicate;  // nullptr if every row qualifies
+    BlockIDCursor *block_ids;
+    SlottedPage *block;
+    RecordIDs *record_ids;
+    size_t position;
+
+    void release_block();
+};
+
+
+/**
+ * @class HeapTableBatchCursor - decodes a HeapTable's records straight from its blocks into RowBatches
+ */
+class HeapTableBatchCursor : public BatchCursor {
+public:
+    HeapTableBatchCursor(HeapTable &table, const ColumnNames *column_names);
+
+    virtual ~HeapTableBatchCursor();
+
+    HeapTableBatchCursor(const HeapTableBatchCursor &other) = delete;
+
+    HeapTableBatchCursor &operator=(const HeapTableBatchCursor &other) = delete;
+
+    virtual bool next(RowBatch &batch);
+
+protected:
+    HeapTable &table;
+    std::vector<int> slots;  // for each of the table's columns, its index in the batch (or -1 to skip it)
+    BlockIDCursor *block_ids;
+    SlottedPage *block;
+    RecordIDs *record_ids;
+    size_t position;
+
+    void release_block();
+};
+
+bool test_heap_storage();
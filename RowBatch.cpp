@@ -0,0 +1,273 @@
+/**
+ * @file RowBatch.cpp - implementation of column-oriented row batches
+ * @author Marwa, Ramya
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "RowBatch.h"
+
+using namespace std;
+
+/**
+ * Empty the column.
+ */
+void ColumnVector::clear() {
+    this->ints.clear();
+    this->bools.clear();
+    this->offsets.clear();
+    this->lengths.clear();
+    this->text.clear();
+}
+
+/**
+ * Add a value to the end of the column.
+ * @param value  value to add (assumed to be of the column's data type)
+ */
+void ColumnVector::append(const Value &value) {
+    if (this->data_type == ColumnAttribute::INT) {
+        this->ints.push_back(value.n);
+    } else if (this->data_type == ColumnAttribute::BOOLEAN) {
+        this->bools.push_back((u_int8_t) value.n);
+    } else {
+        this->offsets.push_back((u_int32_t) this->text.size());
+        this->lengths.push_back((u_int16_t) value.s.size());
+        this->text.append(value.s);
+    }
+}
+
+/**
+ * Get one value out of the column.
+ * @param row  position in the column
+ * @return     the value
+ */
+Value ColumnVector::get(uint row) const {
+    Value value;
+    value.data_type = this->data_type;
+    if (this->data_type == ColumnAttribute::INT)
+        value.n = this->ints[row];
+    else if (this->data_type == ColumnAttribute::BOOLEAN)
+        value.n = this->bools[row];
+    else
+        value.s = this->text.substr(this->offsets[row], this->lengths[row]);
+    return value;
+}
+
+
+/**
+ * Constructor
+ * @param column_names       columns carried by this batch
+ * @param column_attributes  corresponding data types
+ */
+RowBatch::RowBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes) : column_names(
+        column_names), columns(), handles(), selection() {
+    for (auto const &column_attribute: column_attributes)
+        this->columns.push_back(ColumnVector(ColumnAttribute(column_attribute).get_data_type()));
+    this->handles.reserve(CAPACITY);
+    this->selection.reserve(CAPACITY);
+}
+
+/**
+ * Empty out the batch.
+ */
+void RowBatch::clear() {
+    for (auto &column: this->columns)
+        column.clear();
+    this->handles.clear();
+    this->selection.clear();
+}
+
+/**
+ * Position of a column in the batch.
+ * @param column_name
+ * @return  index into the batch's columns or -1 if not present
+ */
+int RowBatch::column_index(const Identifier &column_name) const {
+    for (uint i = 0; i < this->column_names.size(); i++)
+        if (this->column_names[i] == column_name)
+            return (int) i;
+    return -1;
+}
+
+/**
+ * Build a dictionary for one row.
+ * @param row           which row
+ * @param column_names  which columns (nullptr for all of them)
+ * @return              the row (freed by caller)
+ */
+ValueDict *RowBatch::get_row(uint row, const ColumnNames *column_names) const {
+    ValueDict *result = new ValueDict();
+    if (column_names == nullptr) {
+        for (uint i = 0; i < this->columns.size(); i++)
+            (*result)[this->column_names[i]] = this->columns[i].get(row);
+        return result;
+    }
+    for (auto const &column_name: *column_names) {
+        int index = column_index(column_name);
+        if (index < 0) {
+            delete result;
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        }
+        (*result)[column_name] = this->columns[index].get(row);
+    }
+    return result;
+}
+
+/**
+ * Select every row.
+ */
+void RowBatch::select_all() {
+    this->selection.resize(this->handles.size());
+    for (uint i = 0; i < this->handles.size(); i++)
+        this->selection[i] = (u_int16_t) i;
+}
+
+/**
+ * Keep only the selected rows whose value in the given column matches. The INT and BOOLEAN loops
+ * are branch-free: each candidate is written out and the output position only advances on a match.
+ * @param index  column in the batch
+ * @param value  value to match
+ */
+void RowBatch::filter_eq(uint index, const Value &value) {
+    const ColumnVector &column = this->columns[index];
+    u_int16_t *selected = this->selection.data();
+    uint count = (uint) this->selection.size();
+    uint out = 0;
+    if (value.data_type != column.data_type) {
+        out = 0;
+    } else if (column.data_type == ColumnAttribute::INT) {
+        const int32_t *ints = column.ints.data();
+        int32_t n = value.n;
+        for (uint i = 0; i < count; i++) {
+            u_int16_t row = selected[i];
+            selected[out] = row;
+            out += ints[row] == n;
+        }
+    } else if (column.data_type == ColumnAttribute::BOOLEAN) {
+        const u_int8_t *bools = column.bools.data();
+        u_int8_t b = (u_int8_t) value.n;
+        for (uint i = 0; i < count; i++) {
+            u_int16_t row = selected[i];
+            selected[out] = row;
+            out += bools[row] == b;
+        }
+    } else {
+        const char *text = column.text.data();
+        const char *s = value.s.data();
+        u_int16_t size = (u_int16_t) value.s.size();
+        for (uint i = 0; i < count; i++) {
+            u_int16_t row = selected[i];
+            if (column.lengths[row] == size && memcmp(text + column.offsets[row], s, size) == 0)
+                selected[out++] = row;
+        }
+    }
+    this->selection.resize(out);
+}
+
+/**
+ * Apply a whole conjunction to the selection.
+ * @param conjunction
+ */
+void RowBatch::filter(const ValueDict *conjunction) {
+    if (conjunction == nullptr)
+        return;
+    for (auto const &predicate: *conjunction) {
+        if (this->selection.empty())
+            return;
+        int index = column_index(predicate.first);
+        if (index < 0)
+            throw DbRelationError("table does not have column named '" + predicate.first + "'");
+        filter_eq((uint) index, predicate.second);
+    }
+}
+
+/**
+ * Keep only the selected rows whose value in the given column satisfies the comparison. Equality goes to
+ * filter_eq; otherwise each value is compared (as memcmp would, for TEXT) and the operator applied.
+ * @param index       column in the batch
+ * @param comparison  operator and value
+ */
+void RowBatch::filter_compare(uint index, const Comparison &comparison) {
+    if (comparison.op == Comparison::EQ) {
+        filter_eq(index, comparison.value);
+        return;
+    }
+    const ColumnVector &column = this->columns[index];
+    u_int16_t *selected = this->selection.data();
+    uint count = (uint) this->selection.size();
+    uint out = 0;
+    Comparison::Op op = comparison.op;
+    if (op == Comparison::IN) {
+        for (uint i = 0; i < count; i++) {
+            u_int16_t row = selected[i];
+            selected[out] = row;
+            out += comparison.matches(column.get(row));
+        }
+    } else if (comparison.value.data_type != column.data_type) {
+        out = 0;
+    } else if (column.data_type == ColumnAttribute::TEXT) {
+        const char *text = column.text.data();
+        const string &s = comparison.value.s;
+        for (uint i = 0; i < count; i++) {
+            u_int16_t row = selected[i];
+            u_int16_t length = column.lengths[row];
+            int cmp = memcmp(text + column.offsets[row], s.data(), min((size_t) length, s.size()));
+            if (cmp == 0)
+                cmp = (int) length - (int) s.size();
+            selected[out] = row;
+            out += Comparison::holds(op, cmp);
+        }
+    } else {
+        int32_t n = comparison.value.n;
+        for (uint i = 0; i < count; i++) {
+            u_int16_t row = selected[i];
+            int32_t value = column.data_type == ColumnAttribute::INT ? column.ints[row] : column.bools[row];
+            selected[out] = row;
+            out += Comparison::holds(op, (value > n) - (value < n));
+        }
+    }
+    this->selection.resize(out);
+}
+
+/**
+ * Apply a whole conjunction of comparisons to the selection.
+ * @param conjunction
+ */
+void RowBatch::filter(const Comparisons *conjunction) {
+    if (conjunction == nullptr)
+        return;
+    for (auto const &comparison: *conjunction) {
+        if (this->selection.empty())
+            return;
+        int index = column_index(comparison.column_name);
+        if (index < 0)
+            throw DbRelationError("table does not have column named '" + comparison.column_name + "'");
+        filter_compare((uint) index, comparison);
+    }
+}
+
+/**
+ * Narrow the selection to the rows that pass any one of the conjunctions: each is applied to the selection as it
+ * was, and the survivors are merged back in row order.
+ * @param disjunction
+ */
+void RowBatch::filter(const Disjunction *disjunction) {
+    if (disjunction == nullptr)
+        return;
+    if (disjunction->size() == 1) {
+        filter(&disjunction->front());
+        return;
+    }
+    SelectionVector candidates = this->selection;
+    SelectionVector passed, merged;
+    for (auto const &conjunction: *disjunction) {
+        this->selection = candidates;
+        filter(&conjunction);
+        merged.clear();
+        set_union(passed.begin(), passed.end(), this->selection.begin(), this->selection.end(),
+                  back_inserter(merged));
+        passed.swap(merged);
+    }
+    this->selection.swap(passed);
+}
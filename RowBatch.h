@@ -0,0 +1,142 @@
+/**
+ * @file RowBatch.h - Column-oriented batches of rows for vectorized evaluation.
+ * ColumnVector
+ * RowBatch
+ *
+ * @author Marwa, Ramya
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+/**
+ * Positions (within a RowBatch) of the rows that are still qualifying.
+ */
+typedef std::vector<u_int16_t> SelectionVector;
+
+/**
+ * @class ColumnVector - the values of one column for every row in a RowBatch
+ *
+ * INT values are kept in ints, BOOLEAN values in bools, and TEXT values as (offset, length) views
+ * into the shared text buffer, so no per-value objects are built.
+ */
+class ColumnVector {
+public:
+    explicit ColumnVector(ColumnAttribute::DataType data_type) : data_type(data_type) {}
+
+    ColumnAttribute::DataType data_type;
+    std::vector<int32_t> ints;
+    std::vector<u_int8_t> bools;
+    std::vector<u_int32_t> offsets;
+    std::vector<u_int16_t> lengths;
+    std::string text;
+
+    void clear();
+
+    void append(const Value &value);
+
+    Value get(uint row) const;
+};
+
+
+/**
+ * @class RowBatch - up to CAPACITY rows of some of a relation's columns, stored column by column
+ *
+ * Filtering works on the selection vector: it starts out holding every row and each predicate
+ * narrows it down with a tight loop over one column.
+ */
+class RowBatch {
+public:
+    static const uint CAPACITY = 1024;
+
+    RowBatch(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual ~RowBatch() {}
+
+    /**
+     * Empty the batch so it can be refilled.
+     */
+    void clear();
+
+    uint size() const { return (uint) handles.size(); }
+
+    bool full() const { return handles.size() >= CAPACITY; }
+
+    const ColumnNames &get_column_names() const { return column_names; }
+
+    /**
+     * Find which column of the batch holds the given relation column.
+     * @param column_name  name of the column
+     * @returns            its position in the batch, or -1 if it isn't in the batch
+     */
+    int column_index(const Identifier &column_name) const;
+
+    ColumnVector &column(uint index) { return columns[index]; }
+
+    const ColumnVector &column(uint index) const { return columns[index]; }
+
+    /**
+     * Start a new row (its column values must then be appended to every ColumnVector).
+     * @param handle  where the row lives in its relation
+     */
+    void add_row(Handle handle) { handles.push_back(handle); }
+
+    Handle get_handle(uint row) const { return handles[row]; }
+
+    /**
+     * Build a dictionary for one row of the batch.
+     * @param row           position of the row in the batch
+     * @param column_names  columns to include (all the batch's columns if nullptr)
+     * @returns             the row's values (freed by caller)
+     */
+    ValueDict *get_row(uint row, const ColumnNames *column_names = nullptr) const;
+
+    const SelectionVector &get_selection() const { return selection; }
+
+    /**
+     * Mark every row in the batch as qualifying.
+     */
+    void select_all();
+
+    /**
+     * Narrow the selection to the rows where the given column equals value.
+     * @param index  which column of the batch
+     * @param value  value to compare against (rows of a different data type never match)
+     */
+    void filter_eq(uint index, const Value &value);
+
+    /**
+     * Narrow the selection with every predicate in a conjunction.
+     * @param conjunction  column/value pairs that must all be equal
+     * @throws             DbRelationError if a predicate's column isn't in the batch
+     */
+    void filter(const ValueDict *conjunction);
+
+    /**
+     * Narrow the selection to the rows where the given column compares with the comparison's value as it says.
+     * @param index       which column of the batch
+     * @param comparison  operator and value (rows of a different data type never match)
+     */
+    void filter_compare(uint index, const Comparison &comparison);
+
+    /**
+     * Narrow the selection with every comparison in a conjunction.
+     * @param conjunction  comparisons that must all hold
+     * @throws             DbRelationError if a comparison's column isn't in the batch
+     */
+    void filter(const Comparisons *conjunction);
+
+    /**
+     * Narrow the selection to the rows that pass any one of a disjunction's conjunctions.
+     * @param disjunction  conjunctions one of which must hold
+     * @throws             DbRelationError if a comparison's column isn't in the batch
+     */
+    void filter(const Disjunction *disjunction);
+
+protected:
+    ColumnNames column_names;
+    std::vector<ColumnVector> columns;
+    Handles handles;
+    SelectionVector selection;
+};
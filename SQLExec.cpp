@@ -63,7 +63,7 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) {
     // initialize _tables table, if not yet present
     if (SQLExec::tables == nullptr) {
         SQLExec::tables = new Tables();
-        SQLExec::indices = new Indices();
+        SQLExec::indices = (Indices *) &Tables::get_table(Indices::TABLE_NAME);  // same HeapFile as queries on it
     }
 
     try {
@@ -164,20 +164,14 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     //making the evaluation plan
     EvalPlan *plan = new EvalPlan(table);
 
-    ValueDict* where = new ValueDict;
     if (statement->expr != NULL){
-        try{
-            where = get_where_conjunction(statement->expr);
-        }
-        catch (exception &e){
-            throw;
-        }
         // defining evalPlan with the where clause
-        plan = new EvalPlan(where, plan);
+        plan = new EvalPlan(get_where_disjunction(statement->expr), plan);
     }
 
     //execute evalutation plan to get list of handles
-    EvalPlan *opt = plan->optimize();
+    DbIndices lookup_indices = get_lookup_indices(table_name);
+    EvalPlan *opt = plan->optimize(&lookup_indices);
     EvalPipeline pipeline = opt->pipeline();
     Handles *handles = pipeline.second;
 
@@ -197,7 +191,6 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     for (auto const& handle: *handles){
         table.del(handle);
     }
-    delete where; //clear up memory
     if (index_size == 0) {
         return new QueryResult("successfully deleted " + to_string(handle_size)
             + " rows from " + table_name);
@@ -206,45 +199,151 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
         + " rows from " + table_name + " and " + to_string(index_size) + " indices");
 }
 
-ValueDict* SQLExec::get_where_conjunction(const Expr* expr) {
-    ValueDict* where_list = new ValueDict;
+DbIndices SQLExec::get_lookup_indices(Identifier table_name) {
+    DbIndices lookup_indices;
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name)) {
+        ColumnNames column_names;
+        bool is_hash, is_unique;
+        SQLExec::indices->get_columns(table_name, index_name, column_names, is_hash, is_unique);
+        if (!is_hash)  // hash indices are just placeholders so far
+            lookup_indices.push_back(&SQLExec::indices->get_index(table_name, index_name));
+    }
+    return lookup_indices;
+}
+
+// Value of an INT or TEXT literal in a where clause.
+static Value literal_value(const Expr *expr) {
+    if (expr->type == kExprLiteralString)
+        return Value(expr->name);
+    if (expr->type == kExprLiteralInt)
+        return Value(expr->ival);
+    throw DbRelationError("invalid only support INT and String");
+}
+
+// Comparison operator of a SIMPLE_OP, NOT_EQUALS, LESS_EQ, or GREATER_EQ expression.
+static Comparison::Op comparison_op(const Expr *expr) {
+    switch (expr->opType) {
+        case Expr::NOT_EQUALS:
+            return Comparison::NE;
+        case Expr::LESS_EQ:
+            return Comparison::LE;
+        case Expr::GREATER_EQ:
+            return Comparison::GE;
+        case Expr::SIMPLE_OP:
+            switch (expr->opChar) {
+                case '=':
+                    return Comparison::EQ;
+                case '<':
+                    return Comparison::LT;
+                case '>':
+                    return Comparison::GT;
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+    throw DbRelationError("currently supports =, <>, <, <=, >, >=, BETWEEN, and IN predicates only");
+}
+
+// The same comparison with its sides swapped (5 < x is x > 5).
+static Comparison::Op reverse(Comparison::Op op) {
+    switch (op) {
+        case Comparison::LT:
+            return Comparison::GT;
+        case Comparison::LE:
+            return Comparison::GE;
+        case Comparison::GT:
+            return Comparison::LT;
+        case Comparison::GE:
+            return Comparison::LE;
+        default:
+            return op;
+    }
+}
+
+// Name of the column a where clause refers to, with its table if it gives one and qualified is set.
+static Identifier where_column(const Expr *column, bool qualified) {
+    if (qualified && column->table != nullptr)
+        return string(column->table) + "." + column->name;
+    return column->name;
+}
+
+// Most conjunctions a where clause may turn into once its ANDs are distributed over its ORs.
+static const size_t MAX_WHERE_TERMS = 64;
 
+Disjunction* SQLExec::get_where_disjunction(const Expr* expr, bool qualified) {
     if (expr->type != kExprOperator) {
         throw DbRelationError("Operator is INVALID!!");
     }
 
-    if (expr->opType == Expr::AND) {
-        ValueDict* first = get_where_conjunction(expr->expr); //recursively get left
-        if (first != nullptr) {
-            where_list->insert(first->begin(), first->end());
+    Disjunction* where_list = new Disjunction;
+    Disjunction* first = nullptr;
+    Disjunction* second = nullptr;
+    try {
+        if (expr->opType == Expr::AND) {
+            // (a OR b) AND c is (a AND c) OR (b AND c)
+            first = get_where_disjunction(expr->expr, qualified); //recursively get left
+            second = get_where_disjunction(expr->expr2, qualified);
+            if (first->size() * second->size() > MAX_WHERE_TERMS)
+                throw DbRelationError("too many ORs in where clause");
+            for (auto const &left: *first)
+                for (auto const &right: *second) {
+                    Comparisons conjunction = left;
+                    conjunction.insert(conjunction.end(), right.begin(), right.end());
+                    where_list->push_back(conjunction);
+                }
+        } else if (expr->opType == Expr::OR) {
+            first = get_where_disjunction(expr->expr, qualified);
+            second = get_where_disjunction(expr->expr2, qualified);
+            if (first->size() + second->size() > MAX_WHERE_TERMS)
+                throw DbRelationError("too many ORs in where clause");
+            where_list->insert(where_list->end(), first->begin(), first->end());
+            where_list->insert(where_list->end(), second->begin(), second->end());
+        } else if (expr->opType == Expr::IN) {
+            if (expr->expr->type != kExprColumnRef || expr->exprList == nullptr)
+                throw DbRelationError("IN must be on a column with a list of values");
+            vector<Value> values;
+            for (auto const value: *expr->exprList)
+                values.push_back(literal_value(value));
+            where_list->push_back(Comparisons(1, Comparison(where_column(expr->expr, qualified), values)));
+        } else if (expr->opType == Expr::BETWEEN) {  // col BETWEEN low AND high is col >= low AND col <= high
+            if (expr->expr->type != kExprColumnRef || expr->exprList == nullptr || expr->exprList->size() != 2)
+                throw DbRelationError("BETWEEN must be on a column");
+            Identifier col = where_column(expr->expr, qualified);
+            Comparisons conjunction;
+            conjunction.push_back(Comparison(col, Comparison::GE, literal_value((*expr->exprList)[0])));
+            conjunction.push_back(Comparison(col, Comparison::LE, literal_value((*expr->exprList)[1])));
+            where_list->push_back(conjunction);
+        } else {
+            Comparison::Op op = comparison_op(expr);
+            if (expr->expr->type == kExprColumnRef)
+                where_list->push_back(
+                        Comparisons(1, Comparison(where_column(expr->expr, qualified), op,
+                                                  literal_value(expr->expr2))));
+            else if (expr->expr2->type == kExprColumnRef)
+                where_list->push_back(
+                        Comparisons(1, Comparison(where_column(expr->expr2, qualified), reverse(op),
+                                                  literal_value(expr->expr))));
+            else
+                throw DbRelationError("predicates must compare a column with a value");
         }
-        ValueDict* second = get_where_conjunction(expr->expr2);
-        where_list->insert(second->begin(), second->end());
+    } catch (...) {
         delete first;
         delete second;
-    }else if (expr->opType == Expr::SIMPLE_OP) {
-        if (expr->opChar != '=') {//handles equality in statement
-            throw DbRelationError("currently supports equality predicates only");
-        }
-        Identifier col = expr->expr->name;
-
-        if (expr->expr2->type == kExprLiteralString) {
-            where_list->insert(pair<Identifier, Value>(col, Value(expr->expr2->name)));
-        }
-        else if (expr->expr2->type == kExprLiteralInt) {
-            where_list->insert(pair<Identifier, Value>(col, Value(expr->expr2->ival)));
-        }
-        else {
-            throw DbRelationError("invalid only support INT and String");
-        }
-    }else {
-        throw DbRelationError("Supports AND conjunctions only");
+        delete where_list;
+        throw;
     }
+    delete first;
+    delete second;
 
     return where_list;
 }
 
 QueryResult *SQLExec::select(const SelectStatement *statement) {
+    if (statement->fromTable->type == kTableJoin)
+        return select_join(statement);
 
     // get table name
     Identifier table_name = statement->fromTable->name;
@@ -273,20 +372,166 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
 
     //enclose that in a select if we have a where clause
     if (statement->whereClause != nullptr) {
-        plan = new EvalPlan(get_where_conjunction(statement->whereClause), plan);
+        plan = new EvalPlan(get_where_disjunction(statement->whereClause), plan);
     }
 
     //project
     plan = new EvalPlan(column_names, plan);
 
-    //optimize the plan and evaluate the optimized plan
-    EvalPlan* optimized = plan->optimize();
+    //optimize the plan (using any indices on the table) and evaluate the optimized plan
+    DbIndices lookup_indices = get_lookup_indices(table_name);
+    EvalPlan* optimized = plan->optimize(&lookup_indices);
     ValueDicts* rows = optimized->evaluate();
 
     ColumnAttributes* column_attributes = table.get_column_attributes(*column_names);
     return new QueryResult(column_names, column_attributes, rows, "successufly returned " + to_string(rows->size()) + " rows");
 }
 
+// Whether a table has a column by the given name.
+static bool has_column(const DbRelation &table, const Identifier &column_name) {
+    const ColumnNames &column_names = table.get_column_names();
+    return find(column_names.begin(), column_names.end(), column_name) != column_names.end();
+}
+
+// Which side of a join a column is on: 0 for the left table, 1 for the right. A qualified column goes by the
+// table's name or alias; an unqualified one (table_name nullptr) by which of the tables has a column by that name.
+static int join_side(const char *table_name, const Identifier &column_name, const TableRef *const refs[2],
+                     DbRelation *const tables[2]) {
+    if (table_name != nullptr) {
+        for (int side = 0; side < 2; side++)
+            if (string(table_name) == refs[side]->name ||
+                (refs[side]->alias != nullptr && string(table_name) == refs[side]->alias)) {
+                if (!has_column(*tables[side], column_name))
+                    throw SQLExecError("unknown column " + string(table_name) + "." + column_name);
+                return side;
+            }
+        throw SQLExecError("unknown table " + string(table_name));
+    }
+    bool in_left = has_column(*tables[0], column_name), in_right = has_column(*tables[1], column_name);
+    if (in_left && in_right)
+        throw SQLExecError("column " + column_name + " is ambiguous");
+    if (!in_left && !in_right)
+        throw SQLExecError("unknown column " + column_name);
+    return in_left ? 0 : 1;
+}
+
+static int join_side(const Expr *column, const TableRef *const refs[2], DbRelation *const tables[2]) {
+    if (column->type != kExprColumnRef)
+        throw SQLExecError("expected a column");
+    return join_side(column->table, column->name, refs, tables);
+}
+
+// Pull the pairs of join columns out of an ON condition of equalities (ANDed together).
+static void join_keys(const Expr *condition, const TableRef *const refs[2], DbRelation *const tables[2],
+                      ColumnNames &left_keys, ColumnNames &right_keys) {
+    if (condition->type == kExprOperator && condition->opType == Expr::AND) {
+        join_keys(condition->expr, refs, tables, left_keys, right_keys);
+        join_keys(condition->expr2, refs, tables, left_keys, right_keys);
+        return;
+    }
+    if (condition->type != kExprOperator || condition->opType != Expr::SIMPLE_OP || condition->opChar != '=')
+        throw SQLExecError("only equijoins are supported");
+    int side = join_side(condition->expr, refs, tables);
+    if (join_side(condition->expr2, refs, tables) == side)
+        throw SQLExecError("join condition must compare a column of each table");
+    const Expr *left = side == 0 ? condition->expr : condition->expr2;
+    const Expr *right = side == 0 ? condition->expr2 : condition->expr;
+    left_keys.push_back(left->name);
+    right_keys.push_back(right->name);
+}
+
+/**
+ * select method for two tables joined on equal columns
+ * USAGE :: select * from foo join bar on foo.id = bar.foo_id where ...
+ * Columns that both tables have come back named <table>.<column>.
+ * @param statement
+ * @return Query result
+ */
+QueryResult *SQLExec::select_join(const SelectStatement *statement) {
+    const JoinDefinition *join = statement->fromTable->join;
+    if (join->type != kJoinInner)
+        throw SQLExecError("only inner joins are supported");
+    if (join->left->type != kTableName || join->right->type != kTableName || join->condition == nullptr)
+        throw SQLExecError("can only join two tables on a condition");
+    const TableRef *const refs[2] = {join->left, join->right};
+    if (string(refs[0]->name) == refs[1]->name)
+        throw SQLExecError("joining a table with itself is not supported");
+    DbRelation *const tables[2] = {&SQLExec::tables->get_table(refs[0]->name),
+                                   &SQLExec::tables->get_table(refs[1]->name)};
+
+    ColumnNames left_keys, right_keys;
+    join_keys(join->condition, refs, tables, left_keys, right_keys);
+
+    // the joined rows have the columns both tables have under <table>.<column> only
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    for (auto const &expr: *statement->selectList) {
+        if (expr->type != kExprStar && expr->type != kExprColumnRef)
+            return new QueryResult("Invalid select expression");
+        for (int side = 0; side < 2; side++) {
+            DbRelation &table = *tables[side];
+            ColumnNames wanted;
+            if (expr->type == kExprStar)
+                wanted = table.get_column_names();
+            else if (join_side(expr, refs, tables) == side)
+                wanted.push_back(expr->name);
+            ColumnAttributes *attributes = table.get_column_attributes(wanted);
+            for (uint i = 0; i < wanted.size(); i++) {
+                bool shared = has_column(*tables[1 - side], wanted[i]);
+                column_names.push_back(shared ? table.get_table_name() + "." + wanted[i] : wanted[i]);
+                column_attributes.push_back((*attributes)[i]);
+            }
+            delete attributes;
+        }
+    }
+
+    // where clause columns are found the same way, and named as in the joined rows
+    Disjunction *where = nullptr;
+    if (statement->whereClause != nullptr) {
+        where = get_where_disjunction(statement->whereClause, true);
+        try {
+            for (auto &conjunction: *where)
+                for (auto &predicate: conjunction) {
+                    size_t dot = predicate.column_name.find('.');
+                    Identifier qualifier = dot == string::npos ? "" : predicate.column_name.substr(0, dot);
+                    Identifier column_name = dot == string::npos ? predicate.column_name :
+                                             predicate.column_name.substr(dot + 1);
+                    int side = join_side(dot == string::npos ? nullptr : qualifier.c_str(), column_name, refs,
+                                         tables);
+                    bool shared = has_column(*tables[1 - side], column_name);
+                    predicate.column_name = shared ? tables[side]->get_table_name() + "." + column_name : column_name;
+                }
+        } catch (...) {
+            delete where;
+            throw;
+        }
+    }
+
+    EvalPlan *plan = new EvalPlan(new EvalPlan(*tables[0]), new EvalPlan(*tables[1]), new ColumnNames(left_keys),
+                                  new ColumnNames(right_keys));
+    if (where != nullptr)
+        plan = new EvalPlan(where, plan);
+    plan = new EvalPlan(new ColumnNames(column_names), plan);
+
+    DbIndices lookup_indices = get_lookup_indices(refs[0]->name);
+    DbIndices right_indices = get_lookup_indices(refs[1]->name);
+    lookup_indices.insert(lookup_indices.end(), right_indices.begin(), right_indices.end());
+    EvalPlan *optimized = plan->optimize(&lookup_indices);
+    ValueDicts *rows;
+    try {
+        rows = optimized->evaluate();
+    } catch (...) {
+        delete optimized;
+        delete plan;
+        throw;
+    }
+    delete optimized;
+    delete plan;
+
+    return new QueryResult(new ColumnNames(column_names), new ColumnAttributes(column_attributes), rows,
+                           "successufly returned " + to_string(rows->size()) + " rows");
+}
+
 void
 SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_name, ColumnAttribute &column_attribute) {
     column_name = col->name;
@@ -581,3 +826,104 @@ QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
     return new QueryResult(column_names, column_attributes, rows, "successfully returned " + to_string(n) + " rows");
 }
 
+// Test helper: parse and execute one SQL statement (the result is freed by caller)
+static QueryResult *test_sql(const string &sql) {
+    SQLParserResult *parse = SQLParser::parseSQLString(sql);
+    if (!parse->isValid() || parse->size() != 1) {
+        delete parse;
+        throw SQLExecError("invalid SQL: " + sql);
+    }
+    QueryResult *result;
+    try {
+        result = SQLExec::execute(parse->getStatement(0));
+    } catch (...) {
+        delete parse;
+        throw;
+    }
+    delete parse;
+    return result;
+}
+
+// Test helper: whether executing the SQL is refused
+static bool test_sql_refused(const string &sql) {
+    try {
+        delete test_sql(sql);
+    } catch (SQLExecError &) {
+        return true;
+    }
+    return false;
+}
+
+bool test_sql_join() {
+    delete test_sql("create table _test_join_l (id int, name text, c int)");
+    delete test_sql("create table _test_join_r (lid int, v int, name text)");
+    for (int i = 0; i < 100; i++)
+        delete test_sql("insert into _test_join_l values (" + to_string(i) + ", 'L" + to_string(i) + "', " +
+                        to_string(i % 5) + ")");
+    for (int j = 0; j < 300; j++)
+        delete test_sql("insert into _test_join_r values (" + to_string(j % 120) + ", " + to_string(j) + ", 'R" +
+                        to_string(j) + "')");
+    bool ok = true;
+
+    // every pair with id = lid, hashed in memory and then spilled to partitions
+    uint expected = 0;
+    for (int j = 0; j < 300; j++)
+        if (j % 120 < 100)
+            expected++;
+    for (u_long memory: {100000UL, 30UL}) {
+        EvalPlan::join_memory = memory;
+        QueryResult *result = test_sql(
+                "select * from _test_join_l join _test_join_r on _test_join_l.id = _test_join_r.lid");
+        ColumnNames names = {"id", "_test_join_l.name", "c", "lid", "v", "_test_join_r.name"};
+        bool joined = *result->get_column_names() == names && result->get_rows()->size() == expected;
+        for (auto const row: *result->get_rows())
+            joined = joined && row->size() == names.size() && row->at("id") == row->at("lid") &&
+                     row->at("_test_join_l.name").s == "L" + to_string(row->at("id").n) &&
+                     row->at("_test_join_r.name").s == "R" + to_string(row->at("v").n);
+        delete result;
+        if (!joined) {
+            cout << "join failed with join_memory " << memory << endl;
+            ok = false;
+        }
+    }
+    EvalPlan::join_memory = 100000;
+
+    // a where clause on both tables, one column of it qualified
+    expected = 0;
+    for (int j = 150; j < 300; j++)
+        if (j % 120 < 100 && j % 120 % 5 == 3)
+            expected++;
+    QueryResult *result = test_sql("select v, _test_join_l.name from _test_join_r join _test_join_l on lid = id "
+                                   "where c = 3 and _test_join_r.v >= 150");
+    bool selected = result->get_rows()->size() == expected;
+    for (auto const row: *result->get_rows())
+        selected = selected && row->size() == 2 && row->at("v").n >= 150 &&
+                   row->at("_test_join_l.name").s == "L" + to_string(row->at("v").n % 120);
+    delete result;
+    if (!selected) {
+        cout << "join with where clause failed" << endl;
+        ok = false;
+    }
+
+    if (!test_sql_refused("select * from _test_join_l join _test_join_r on _test_join_l.id < _test_join_r.lid") ||
+        !test_sql_refused("select * from _test_join_l join _test_join_r on id = lid where _test_join_r.c = 3") ||
+        !test_sql_refused("select * from _test_join_l join _test_join_r on id = lid where name = 'L3'")) {
+        cout << "join accepted a condition it can't do" << endl;
+        ok = false;
+    }
+
+    // querying _indices goes through the same HeapFile that create index writes to
+    delete test_sql("create index _test_join_fx on _test_join_l (id)");
+    result = test_sql("select index_name from _indices where table_name = '_test_join_l'");
+    bool indexed = dynamic_cast<Indices *>(&Tables::get_table(Indices::TABLE_NAME)) != nullptr &&
+                   result->get_rows()->size() == 1 && result->get_rows()->front()->at("index_name").s == "_test_join_fx";
+    delete result;
+    if (!indexed) {
+        cout << "_indices query missed the new index" << endl;
+        ok = false;
+    }
+
+    delete test_sql("drop table _test_join_l");
+    delete test_sql("drop table _test_join_r");
+    return ok;
+}
@@ -96,7 +96,17 @@ protected:
 
     static QueryResult *select(const hsql::SelectStatement *statement);
 
-    static ValueDict *get_where_conjunction(const hsql::Expr *expr);
+    static QueryResult *select_join(const hsql::SelectStatement *statement);
+
+    // qualified: name a column given as <table>.<column> that way, instead of dropping the table
+    static Disjunction *get_where_disjunction(const hsql::Expr *expr, bool qualified = false);
+
+    /**
+     * Get the indices on a table that can look up keys (for the optimizer)
+     * @param table_name  table the indices are on
+     * @returns           the indices
+     */
+    static DbIndices get_lookup_indices(Identifier table_name);
 
     /**
      * Pull out column name and attributes from AST's column definition clause
@@ -108,3 +118,4 @@ protected:
     column_definition(const hsql::ColumnDefinition *col, Identifier &column_name, ColumnAttribute &column_attribute);
 };
 
+bool test_sql_join();
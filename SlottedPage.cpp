@@ -3,6 +3,7 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
 #include <cstring>
 #include "SlottedPage.h"
 
@@ -14,17 +15,61 @@ typedef uint16_t u16;
  * @param block
  * @param block_id
  * @param is_new
+ * @param frame     pinned buffer frame that block's memory belongs to (we take over the pin), if any
  */
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new) {
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new, BufferFrame *frame) : DbBlock(block, block_id,
+                                                                                                  is_new),
+                                                                                          frame(frame),
+                                                                                          fragmented(-1) {
     if (is_new) {
         this->num_records = 0;
         this->end_free = DbBlock::BLOCK_SZ - 1;
+        this->fragmented = 0;
         put_header();
     } else {
         get_header(this->num_records, this->end_free);
     }
 }
 
+/**
+ * Destructor - releases our pin on the buffer frame.
+ */
+SlottedPage::~SlottedPage() {
+    if (this->frame != nullptr)
+        this->frame->get_pool()->unpin(this->frame);
+}
+
+/**
+ * Copy constructor - the copy shares the block memory, so it needs its own pin.
+ * @param other
+ */
+SlottedPage::SlottedPage(const SlottedPage &other) : DbBlock(other), num_records(other.num_records),
+                                                     end_free(other.end_free), frame(other.frame),
+                                                     fragmented(other.fragmented) {
+    if (this->frame != nullptr)
+        this->frame->get_pool()->pin(this->frame);
+}
+
+/**
+ * Copy assignment - trade our pin for one on the other's frame.
+ * @param other
+ * @return this
+ */
+SlottedPage &SlottedPage::operator=(const SlottedPage &other) {
+    if (this != &other) {
+        if (other.frame != nullptr)
+            other.frame->get_pool()->pin(other.frame);
+        if (this->frame != nullptr)
+            this->frame->get_pool()->unpin(this->frame);
+        DbBlock::operator=(other);
+        this->num_records = other.num_records;
+        this->end_free = other.end_free;
+        this->frame = other.frame;
+        this->fragmented = other.fragmented;
+    }
+    return *this;
+}
+
 /**
  * Add a new record to the block.
  * @param data
@@ -33,6 +78,8 @@ SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(bl
 RecordID SlottedPage::add(const Dbt *data) {
     if (!has_room((u16) data->get_size()))
         throw DbBlockNoRoomError("not enough room for new record");
+    if (data->get_size() + 4U > contiguous_bytes())
+        compact();
     u16 id = ++this->num_records;
     u16 size = (u16) data->get_size();
     this->end_free -= size;
@@ -43,6 +90,29 @@ RecordID SlottedPage::add(const Dbt *data) {
     return id;
 }
 
+/**
+ * Add a new record to the block as record_id, renumbering the records from there on up by one.
+ * Only the headers move; the records stay where they are.
+ * @param record_id  1 through one past the last record id
+ * @param data
+ * @throws DbBlockNoRoomError if it won't fit
+ */
+void SlottedPage::insert(RecordID record_id, const Dbt *data) {
+    if (!has_room((u16) data->get_size()))
+        throw DbBlockNoRoomError("not enough room for new record");
+    if (data->get_size() + 4U > contiguous_bytes())
+        compact();
+    memmove(this->address((u16) (4 * (record_id + 1))), this->address((u16) (4 * record_id)),
+            4U * (this->num_records + 1U - record_id));
+    this->num_records++;
+    u16 size = (u16) data->get_size();
+    this->end_free -= size;
+    u16 loc = this->end_free + 1U;
+    put_header();
+    put_header(record_id, size, loc);
+    memcpy(this->address(loc), data->get_data(), size);
+}
+
 /**
  * Get a record from the block.
  * @param record_id
@@ -56,6 +126,22 @@ Dbt *SlottedPage::get(RecordID record_id) const {
     return new Dbt(this->address(loc), size);
 }
 
+/**
+ * Get a record from the block without allocating anything.
+ * @param record_id
+ * @param data       set to point at the record's bytes within the block (valid while the block is)
+ * @return           false if the record has been deleted
+ */
+bool SlottedPage::get(RecordID record_id, Dbt &data) const {
+    u16 size, loc;
+    get_header(size, loc, record_id);
+    if (loc == 0)
+        return false;  // tombstone
+    data.set_data(this->address(loc));
+    data.set_size(size);
+    return true;
+}
+
 /**
  * Replace the record with the given data.
  * @param record_id   record to replace
@@ -70,11 +156,17 @@ void SlottedPage::put(RecordID record_id, const Dbt &data) {
         u16 extra = new_size - size;
         if (!has_room(extra))
             throw DbBlockNoRoomError("not enough room for enlarged record");
+        if (extra + 4U > contiguous_bytes()) {
+            compact();
+            get_header(size, loc, record_id);
+        }
         slide(loc, loc - extra);
         memcpy(this->address(loc - extra), data.get_data(), new_size);
     } else {
+        // leave the freed tail of the record as a hole until the next compaction
         memcpy(this->address(loc), data.get_data(), new_size);
-        slide(loc + new_size, loc + size);
+        if (this->fragmented >= 0)
+            this->fragmented += size - new_size;
     }
     get_header(size, loc, record_id);
     put_header(record_id, new_size, loc);
@@ -84,15 +176,45 @@ void SlottedPage::put(RecordID record_id, const Dbt &data) {
  * Delete a record from the page.
  *
  * Mark the given id as deleted by changing its size to zero and its location to 0.
- * Compact the rest of the data in the block. But keep the record ids the same for everyone.
+ * The record's bytes are left as a hole for compact() to reclaim later. Record ids stay the same for everyone.
  *
  * @param record_id  record to delete
  */
 void SlottedPage::del(RecordID record_id) {
     u16 size, loc;
     get_header(size, loc, record_id);
+    if (loc == 0)
+        return;  // already deleted
     put_header(record_id, 0, 0);  // 0 is the tombstone sentinel
-    slide(loc, loc + size);
+    if (this->fragmented >= 0)
+        this->fragmented += size;
+}
+
+/**
+ * Squeeze the holes out of the record area, moving every record as far toward the end of the block as
+ * it can go. The records are moved in order from the end of the block, so each one moves at most once.
+ */
+void SlottedPage::compact() {
+    vector<pair<u16, RecordID>> by_location;
+    u16 size, loc;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        get_header(size, loc, record_id);
+        if (loc != 0)
+            by_location.push_back(pair<u16, RecordID>(loc, record_id));
+    }
+    sort(by_location.rbegin(), by_location.rend());
+    u16 end = DbBlock::BLOCK_SZ;
+    for (auto const &record: by_location) {
+        get_header(size, loc, record.second);
+        end -= size;
+        if (end != loc) {
+            memmove(this->address(end), this->address(loc), size);
+            put_header(record.second, size, end);
+        }
+    }
+    this->end_free = end - 1U;
+    this->fragmented = 0;
+    put_header();
 }
 
 /**
@@ -116,6 +238,7 @@ RecordIDs *SlottedPage::ids(void) const {
 void SlottedPage::clear() {
     this->num_records = 0;
     this->end_free = DbBlock::BLOCK_SZ - 1;
+    this->fragmented = 0;
     put_header();
 }
 
@@ -172,10 +295,19 @@ bool SlottedPage::has_room(u16 size) const {
 }
 
 /**
- * Get the number of bytes not currently used to store data or for overhead.
+ * Get the number of bytes not currently used to store data or for overhead (including the holes that
+ * compact() would reclaim).
  * @return number of bytes
  */
 u16 SlottedPage::unused_bytes() const {
+    return contiguous_bytes() + fragmented_bytes();
+}
+
+/**
+ * Get the number of free bytes between the headers and the records.
+ * @return number of bytes
+ */
+u16 SlottedPage::contiguous_bytes() const {
     u16 headers = (u16) (4 * (this->num_records + 1));
     u16 unused;
     if (this->end_free <= headers)
@@ -185,6 +317,24 @@ u16 SlottedPage::unused_bytes() const {
     return unused;
 }
 
+/**
+ * Get the number of bytes in holes within the record area (counted the first time it's needed).
+ * @return number of bytes
+ */
+u16 SlottedPage::fragmented_bytes() const {
+    if (this->fragmented < 0) {
+        int used = DbBlock::BLOCK_SZ - 1 - this->end_free;
+        u16 size, loc;
+        for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+            get_header(size, loc, record_id);
+            if (loc != 0)
+                used -= size;
+        }
+        this->fragmented = used;
+    }
+    return (u16) this->fragmented;
+}
+
 /**
  * Slide the contents to compensate for a smaller/larger record.
  *
@@ -352,6 +502,22 @@ bool test_slotted_page() {
     if (get_dbt != nullptr)
         return assertion_failure("get of deleted record was not null");
 
+    // insert in the middle renumbers the records after it
+    char rec3[] = "in between";
+    Dbt rec3_dbt(rec3, sizeof(rec3));
+    slot.insert(2, &rec3_dbt);
+    get_dbt = slot.get(2);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != string(rec3, sizeof(rec3)))
+        return assertion_failure("get inserted record " + actual);
+    get_dbt = slot.get(3);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != string(rec2, sizeof(rec2)) || slot.get(1) != nullptr)
+        return assertion_failure("records after insert " + actual);
+    slot.del(2);
+
     // try adding something too big
     rec2_dbt = Dbt(nullptr, DbBlock::BLOCK_SZ - 10); // too big, but only because we have a record in there
     try {
@@ -364,6 +530,40 @@ bool test_slotted_page() {
         return assertion_failure("wrong type thrown when add too big");
     }
 
+    // deletes just leave holes, which get squeezed out when an add needs the room
+    char holey_space[DbBlock::BLOCK_SZ];
+    Dbt holey_dbt(holey_space, sizeof(holey_space));
+    SlottedPage holey(holey_dbt, 2, true);
+    char filler[100];
+    memset(filler, 'x', sizeof(filler));
+    Dbt filler_dbt(filler, sizeof(filler));
+    RecordID last_id = 0;
+    while (holey.unused_bytes() >= sizeof(filler) + 4) {
+        filler[0] = (char) (last_id + 1);
+        last_id = holey.add(&filler_dbt);
+    }
+    u16 end_free = holey.end_free;
+    for (RecordID id = 1; id <= last_id; id += 2)
+        holey.del(id);
+    if (holey.end_free != end_free || holey.unused_bytes() < (last_id / 2) * sizeof(filler))
+        return assertion_failure("del should only leave a hole", holey.end_free, holey.unused_bytes());
+    char big[300];
+    memset(big, 'y', sizeof(big));
+    Dbt big_dbt(big, sizeof(big));
+    RecordID big_id = holey.add(&big_dbt);
+    get_dbt = holey.get(big_id);
+    bool big_ok = get_dbt->get_size() == sizeof(big) && memcmp(get_dbt->get_data(), big, sizeof(big)) == 0;
+    delete get_dbt;
+    if (!big_ok)
+        return assertion_failure("add after compaction");
+    for (RecordID id = 2; id <= last_id; id += 2) {
+        get_dbt = holey.get(id);
+        bool kept = get_dbt->get_size() == sizeof(filler) && *(char *) get_dbt->get_data() == (char) id;
+        delete get_dbt;
+        if (!kept)
+            return assertion_failure("record moved by compaction", id);
+    }
+
     // more volume
     string gettysburg = "Four score and seven years ago our fathers brought forth on this continent, a new nation, conceived in Liberty, and dedicated to the proposition that all men are created equal.";
     int32_t n = -1;
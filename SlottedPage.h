@@ -10,6 +10,7 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "BufferPool.h"
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -24,19 +25,35 @@
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+
+        insert() puts a new record in the middle of the ids instead, shifting the later headers up one.
+
+        Deleting or shrinking a record only fixes up its header, leaving a hole in the record area. Holes count
+        as unused bytes, and are squeezed out all at once by compact() when an add() or an expanding put()
+        needs more contiguous room than is left between the headers and the records.
+
+        A SlottedPage handed out by HeapFile lives in a pinned BufferPool frame and unpins it when destroyed.
  *
  */
 class SlottedPage : public DbBlock {
 public:
-    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false);
+    SlottedPage(Dbt &block, BlockID block_id, bool is_new = false, BufferFrame *frame = nullptr);
+
+    // Big 5 - copies take their own pin on the buffer frame
+    virtual ~SlottedPage();
+
+    SlottedPage(const SlottedPage &other);
 
-    // Big 5 - use the defaults
-    virtual ~SlottedPage() {}
+    SlottedPage &operator=(const SlottedPage &other);
 
     virtual RecordID add(const Dbt *data);
 
+    void insert(RecordID record_id, const Dbt *data);
+
     virtual Dbt *get(RecordID record_id) const;
 
+    bool get(RecordID record_id, Dbt &data) const;
+
     virtual void put(RecordID record_id, const Dbt &data);
 
     virtual void del(RecordID record_id);
@@ -49,10 +66,14 @@ public:
 
     virtual u_int16_t unused_bytes() const;
 
+    virtual void compact();
+
 
 protected:
     uint16_t num_records;
     uint16_t end_free;
+    BufferFrame *frame;  // pinned frame holding our block, or nullptr if the memory isn't from the buffer pool
+    mutable int fragmented;  // bytes in holes left by del/put, or -1 if not counted yet
 
     void get_header(uint16_t &size, uint16_t &loc, RecordID id = 0) const;
 
@@ -60,6 +81,10 @@ protected:
 
     bool has_room(uint16_t size) const;
 
+    uint16_t contiguous_bytes() const;
+
+    uint16_t fragmented_bytes() const;
+
     virtual void slide(uint16_t start, uint16_t end);
 
     uint16_t get_n(uint16_t offset) const;
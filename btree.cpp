@@ -3,6 +3,7 @@
  * @author Kevin Lundeen, Marwa, Ramya
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
+#include <algorithm>
 #include "btree.h"
 
 BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
@@ -14,9 +15,12 @@ BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_co
                                                                                                       root(nullptr),
                                                                                                       file(relation.get_table_name() +
                                                                                                            "-" + name),
-                                                                                                      key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
+                                                                                                      key_profile(),
+                                                                                                      fill_factor(
+                                                                                                              DEFAULT_FILL_FACTOR),
+                                                                                                      min_fill(
+                                                                                                              DEFAULT_MIN_FILL),
+                                                                                                      rightmost() {
     build_key_profile();
 }
 
@@ -31,10 +35,116 @@ void BTreeIndex::create() {
     stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
     root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
     closed = false;
-    Handles *table_rows = relation.select();
-    for (auto const &row: *table_rows)
-        insert(row);
-    delete table_rows;
+    bulk_load();
+}
+
+// Build the tree from the rows already in the relation: sort all the (key, handle) pairs, gather the handles of
+// each key into a posting, pack those into leaves left to right, then pack each level of interior nodes over the
+// one below until one node is left.
+void BTreeIndex::bulk_load() {
+    Handles *handles = relation.select();
+    ValueDicts *keys = relation.project(handles, &key_columns);  // reads each block of the relation once
+    typedef std::pair<KeyBytes, Handle> Entry;
+    std::vector<Entry> entries;
+    entries.reserve(handles->size());
+    for (uint i = 0; i < handles->size(); i++) {
+        entries.push_back(Entry(marshal_key((*keys)[i]), (*handles)[i]));
+        delete (*keys)[i];
+    }
+    delete keys;
+    delete handles;
+    std::sort(entries.begin(), entries.end());
+    if (this->unique)
+        for (uint i = 1; i < entries.size(); i++)
+            if (!(entries[i - 1].first < entries[i].first))
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+    if (entries.empty())
+        return;
+
+    uint room = BTreeNode::NODE_ROOM * this->fill_factor / 100;
+
+    // leaves
+    typedef std::pair<KeyBytes, BlockID> Child;  // lowest key in a node and the node
+    std::vector<Child> level;
+    auto *leaf = dynamic_cast<BTreeLeaf *>(this->root);
+    uint used = 0, count = 0;  // entry_size total and number of entries in the leaf
+    KeyBytes first_key;  // of the leaf
+    level.push_back(Child(entries.front().first, leaf->get_id()));
+    for (uint i = 0; i < entries.size();) {
+        const KeyBytes &key = entries[i].first;
+        Posting posting;
+        for (; i < entries.size() && entries[i].first == key; i++)
+            posting.handles.push_back(entries[i].second);
+        posting.count = (uint) posting.handles.size();
+        uint size = BTreeLeaf::entry_size(key, posting);
+        uint prefix_size = BTreeNode::common_prefix(first_key, key);  // the leaf's prefix if key goes in it
+        if (count > 0 && BTreeLeaf::packed_size(prefix_size, count + 1, used + size) > room) {
+            auto *next = new BTreeLeaf(this->file, 0, this->key_profile, true);
+            leaf->set_next_leaf(next->get_id());
+            leaf->save();
+            if (leaf != this->root)
+                delete leaf;
+            leaf = next;
+            used = count = 0;
+            level.push_back(Child(BTreeNode::separator(entries[i - posting.count - 1].first, key), leaf->get_id()));
+        }
+        if (count == 0)
+            first_key = key;
+        leaf->append(key, posting);
+        used += size;
+        count++;
+    }
+    leaf->save();
+    if (leaf != this->root)
+        delete leaf;
+    entries.clear();
+
+    // interior levels
+    uint height = 1;
+    while (level.size() > 1) {
+        std::vector<Child> parents;
+        BTreeInterior *interior = nullptr;
+        for (uint i = 0; i < level.size(); i++) {
+            uint size = BTreeInterior::entry_size(level[i].first);
+            bool last = i == level.size() - 1;  // squeeze it in rather than leave a node with just one child
+            if (interior == nullptr || (used + size > room && !(last && used + size <= BTreeNode::NODE_ROOM))) {
+                if (interior != nullptr) {
+                    interior->save();
+                    delete interior;
+                }
+                interior = new BTreeInterior(this->file, 0, this->key_profile, true);
+                interior->set_first(level[i].second);
+                parents.push_back(Child(level[i].first, interior->get_id()));
+                used = 0;
+            } else {
+                interior->append(level[i].first, level[i].second);
+                used += size;
+            }
+        }
+        interior->save();
+        delete interior;
+        level.swap(parents);
+        height++;
+    }
+    if (height > 1) {
+        this->stat->set_root_id(level.front().second);
+        this->stat->set_height(height);
+        this->stat->save();
+        delete this->root;
+        this->root = new BTreeInterior(this->file, level.front().second, this->key_profile, false);
+    }
+}
+
+void BTreeIndex::set_fill_factor(uint percent) {
+    if (percent < 10 || percent > 100)
+        throw DbRelationError("fill factor must be between 10 and 100 percent");
+    this->fill_factor = percent;
+}
+
+void BTreeIndex::set_min_fill(uint percent) {
+    if (percent > 50)
+        throw DbRelationError("minimum fill must be between 0 and 50 percent");
+    this->min_fill = percent;
 }
 
 // Drop the index.
@@ -51,18 +161,19 @@ void BTreeIndex::open() {
             root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
         else
             root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+        closed = false;
     }
 }
 
 // Closes the index. Disables: lookup, range, insert, delete, update.
 void BTreeIndex::close() {
     if (!closed) {
-        file.close();
-        delete stat;
+        rightmost.clear();
+        delete stat;  // release the nodes' buffer frames before closing the file under them
         stat = nullptr;
         delete root;
         root = nullptr;
+        file.close();
         closed = true;
     }
 }
@@ -70,37 +181,92 @@ void BTreeIndex::close() {
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
 // names in the index. Returns a list of row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
-    return this->_lookup(this->root, this->stat->get_height(), this->tkey(key_dict));
+    KeyBytes key = marshal_key(key_dict);
+    BTreeLeaf *leaf = find_leaf(&key);
+    Handles *handles = leaf->find_eq(key);
+    delete leaf;
+    return handles;
 }
 
-Handles* BTreeIndex::_lookup(BTreeNode* node, uint height, const KeyValue* key) const {
-    // recursively traverse the tree until you reach a leaf node
-    if (!dynamic_cast<BTreeLeaf*>(node)) {
-        // continue searching a level down
-        return this->_lookup(dynamic_cast<const BTreeInterior*>(node)->find(key, height), height - 1, key);
-    }
+// Whether a key belongs in this leaf rather than a later one (given it doesn't belong in an earlier one).
+static bool leaf_covers(const BTreeLeaf &leaf, const KeyBytes &key) {
+    uint n = leaf.entry_count();
+    return n > 0 && leaf.compare(n - 1, key) >= 0;
+}
 
-    // if you reach leaf, that's the last level to return
-    Handles* results = new Handles();
-    try {
-        results->push_back(dynamic_cast<const BTreeLeaf*>(node)->find_eq(key));
+// Look up the keys in sorted order, so each leaf is read once. A key that's on the same leaf as the one before
+// it, or on the next leaf, is found without going back down from the root.
+HandleLists *BTreeIndex::lookup_batch(const ValueDicts &keys) const {
+    typedef std::pair<KeyBytes, uint> Probe;  // a marshalled key and where it came in keys
+    std::vector<Probe> probes;
+    probes.reserve(keys.size());
+    for (uint i = 0; i < keys.size(); i++)
+        probes.push_back(Probe(marshal_key(keys[i]), i));
+    std::sort(probes.begin(), probes.end());
+
+    auto *results = new HandleLists(keys.size(), nullptr);
+    BTreeLeaf *leaf = nullptr;
+    for (auto const &probe: probes) {
+        const KeyBytes &key = probe.first;
+        if (leaf != nullptr && !leaf_covers(*leaf, key)) {
+            BlockID next_leaf = leaf->get_next_leaf();
+            delete leaf;
+            leaf = nullptr;
+            if (next_leaf != 0) {
+                leaf = new BTreeLeaf(this->file, next_leaf, this->key_profile, false);
+                if (!leaf_covers(*leaf, key)) {
+                    delete leaf;
+                    leaf = nullptr;
+                }
+            }
+        }
+        if (leaf == nullptr)
+            leaf = find_leaf(&key);
+        (*results)[probe.second] = leaf->find_eq(key);
     }
-    catch (...) {}
+    delete leaf;
     return results;
 }
 
-
+// Find all the rows whose keys are between min_key and max_key (inclusive; nullptr for an open end).
 Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME
+    Handles *handles = new Handles();
+    HandleCursor *rows = range_cursor(min_key, max_key);
+    Handle handle;
+    while (rows->next(handle))
+        handles->push_back(handle);
+    delete rows;
+    return handles;
+}
+
+// Streaming range query.
+HandleCursor *BTreeIndex::range_cursor(const ValueDict *min_key, const ValueDict *max_key, bool min_inclusive,
+                                       bool max_inclusive) const {
+    KeyBytes tmin = min_key == nullptr ? KeyBytes() : marshal_key(min_key);
+    KeyBytes tmax = max_key == nullptr ? KeyBytes() : marshal_key(max_key);
+    return new BTreeRangeCursor(*this, min_key == nullptr ? nullptr : &tmin, max_key == nullptr ? nullptr : &tmax,
+                                min_inclusive, max_inclusive);
+}
+
+// Descend (through the cached interior nodes) to the leaf where key would be (the leftmost leaf for nullptr).
+BTreeLeaf *BTreeIndex::find_leaf(const KeyBytes *key) const {
+    BlockID block_id = this->stat->get_root_id();
+    for (uint height = this->stat->get_height(); height > 1; height--) {
+        const BTreeInterior *interior = this->file.get_interior(block_id, this->key_profile);
+        block_id = interior->get_child(interior->find_index(key));
+    }
+    return new BTreeLeaf(this->file, block_id, this->key_profile, false);
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
 void BTreeIndex::insert(Handle handle) {
     open();
-    ValueDict *key = relation.project(handle);
-    KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
+    ValueDict *key = relation.project(handle, &key_columns);
+    KeyBytes tkey = marshal_key(key);
+    delete key;
+    Insertion insertion;
+    if (!append(tkey, handle, insertion))
+        insertion = _insert(root, stat->get_height(), tkey, handle);
     if (!BTreeNode::insertion_is_none(insertion)) {
         auto *new_root = new BTreeInterior(file, 0, key_profile, true);
         new_root->set_first(root->get_id());
@@ -113,18 +279,119 @@ void BTreeIndex::insert(Handle handle) {
         root = new_root;
         std::cout << "new root: " << *new_root << std::endl;
     }
-    delete key;
-    delete tkey;
+}
+
+/**
+ * Constructor
+ * @param index          index to scan (must be open)
+ * @param min_key        lowest key wanted (nullptr for none)
+ * @param max_key        highest key wanted (nullptr for none)
+ * @param min_inclusive  whether min_key itself qualifies
+ * @param max_inclusive  whether max_key itself qualifies
+ */
+BTreeRangeCursor::BTreeRangeCursor(const BTreeIndex &index, const KeyBytes *min_key, const KeyBytes *max_key,
+                                   bool min_inclusive, bool max_inclusive) : index(index),
+                                                                             max_key(max_key == nullptr ? KeyBytes()
+                                                                                                        : *max_key),
+                                                                             bounded(max_key != nullptr),
+                                                                             max_inclusive(max_inclusive),
+                                                                             leaf(nullptr), position(0), posting(),
+                                                                             in_posting(0) {
+    this->leaf = index.find_leaf(min_key);
+    if (min_key == nullptr)
+        this->position = 0;
+    else if (min_inclusive)
+        this->position = this->leaf->lower_bound(*min_key);
+    else
+        this->position = this->leaf->upper_bound(*min_key);
+}
+
+BTreeRangeCursor::~BTreeRangeCursor() {
+    delete this->leaf;
+}
+
+/**
+ * Get the next handle in the range, moving along the leaf chain as needed.
+ * @param handle  set to the next handle
+ * @return        false once past the end of the range
+ */
+bool BTreeRangeCursor::next(Handle &handle) {
+    while (this->leaf != nullptr) {
+        if (this->in_posting < this->posting.size()) {
+            handle = this->posting[this->in_posting++];
+            return true;
+        }
+        if (this->position < this->leaf->entry_count()) {
+            int cmp = this->bounded ? this->leaf->compare(this->position, this->max_key) : -1;
+            if (this->max_inclusive ? cmp > 0 : cmp >= 0) {
+                delete this->leaf;
+                this->leaf = nullptr;
+                return false;
+            }
+            this->posting.clear();
+            this->in_posting = 0;
+            this->leaf->read_posting(this->position, this->posting);
+            this->position++;
+            continue;
+        }
+        BlockID next_leaf = this->leaf->get_next_leaf();
+        delete this->leaf;
+        this->leaf = nullptr;
+        if (next_leaf != 0) {
+            this->leaf = new BTreeLeaf(this->index.file, next_leaf, this->index.key_profile, false);
+            this->position = 0;
+        }
+    }
+    return false;
 }
 
 // Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle) {
+// Add a key that sorts after everything in the index straight to the last leaf, without searching down from the
+// root, and split along the rightmost path as need be. Returns false, with nothing changed, if key goes elsewhere.
+bool BTreeIndex::append(const KeyBytes &key, Handle handle, Insertion &insertion) {
+    uint height = this->stat->get_height();
+    if (height == 1)
+        return false;  // the root leaf is already at hand
+    if (this->rightmost.empty()) {
+        BlockID block_id = this->stat->get_root_id();
+        for (; height > 1; height--) {
+            this->rightmost.push_back(block_id);
+            const BTreeInterior *interior = this->file.get_interior(block_id, this->key_profile);
+            block_id = interior->get_child(interior->child_count() - 1);
+        }
+        this->rightmost.push_back(block_id);
+    }
+    BTreeLeaf leaf(this->file, this->rightmost.back(), this->key_profile, false);
+    uint n = leaf.entry_count();
+    if (n == 0 || leaf.compare(n - 1, key) >= 0 || leaf.get_next_leaf() != 0)
+        return false;
+
+    insertion = leaf.insert(key, handle, this->unique, this->fill_factor);
+    if (BTreeNode::insertion_is_none(insertion))
+        return true;
+    for (uint level = (uint) this->rightmost.size() - 1; level-- > 0 && !BTreeNode::insertion_is_none(insertion);) {
+        if (level == 0) {
+            auto *interior = dynamic_cast<BTreeInterior *>(this->root);
+            insertion = interior->insert(&insertion.second, insertion.first, this->fill_factor);
+        } else {
+            BTreeInterior interior(this->file, this->rightmost[level], this->key_profile, false);
+            insertion = interior.insert(&insertion.second, insertion.first, this->fill_factor);
+        }
+    }
+    this->rightmost.clear();  // found again next time
+    return true;
+}
+
+Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyBytes &key, Handle handle) {
     if (height == 1) {
         auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        return leaf->insert(key, handle);
+        Insertion insertion = leaf->insert(key, handle, this->unique);
+        if (!BTreeNode::insertion_is_none(insertion))
+            this->rightmost.clear();  // might have been the last leaf that split
+        return insertion;
     } else {
         auto *interior = dynamic_cast<BTreeInterior *>(node);
-        auto *child = interior->find(key, height);
+        auto *child = interior->find(&key, height);
         Insertion insertion = _insert(child, height - 1, key, handle);
         delete child;
         if (!BTreeNode::insertion_is_none(insertion))
@@ -133,9 +400,131 @@ Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key,
     }
 }
 
+// Delete the index entry for a row (which must still be in the relation), merging or evening out any nodes
+// left underfull and shrinking the tree when the root is down to one child.
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
+    open();
+    this->rightmost.clear();  // merges can take the last leaf away
+    ValueDict *key = relation.project(handle, &key_columns);
+    KeyBytes tkey = marshal_key(key);
+    delete key;
+    _del(root, stat->get_height(), tkey, handle);
+
+    while (stat->get_height() > 1 && dynamic_cast<BTreeInterior *>(root)->child_count() == 1) {
+        BlockID child = dynamic_cast<BTreeInterior *>(root)->get_child(0);
+        delete root;
+        stat->set_root_id(child);
+        stat->set_height(stat->get_height() - 1);
+        stat->save();
+        if (stat->get_height() == 1)
+            root = new BTreeLeaf(file, child, key_profile, false);
+        else
+            root = new BTreeInterior(file, child, key_profile, false);
+    }
+}
+
+// Recursive delete. Returns true if the node is left underfull.
+bool BTreeIndex::_del(BTreeNode *node, uint height, const KeyBytes &key, Handle handle) {
+    uint min_bytes = BTreeNode::NODE_ROOM * this->min_fill / 100;
+    if (height == 1) {
+        auto *leaf = dynamic_cast<BTreeLeaf *>(node);
+        leaf->del(key, handle);
+        return leaf->used_bytes() < min_bytes;
+    }
+    auto *interior = dynamic_cast<BTreeInterior *>(node);
+    uint index = interior->find_index(&key);
+    BTreeNode *child = interior->find(&key, height);
+    bool underfull;
+    try {
+        underfull = _del(child, height - 1, key, handle);
+    } catch (DbRelationError &e) {
+        delete child;
+        throw;
+    }
+    delete child;
+    if (underfull && interior->child_count() > 1) {
+        rebalance(interior, index, height - 1);
+        return interior->used_bytes() < min_bytes;
+    }
+    return false;
+}
+
+// Fix an underfull child by merging it with a sibling if they fit in one node, otherwise by evening them out.
+// The right-hand node of a merge is dropped from the tree (its block is not reused).
+void BTreeIndex::rebalance(BTreeInterior *parent, uint index, uint height) {
+    uint left = index + 1 < parent->child_count() ? index : index - 1;  // pair with the right sibling if any
+    KeyBytes separator = parent->get_boundary(left);
+    if (height == 1) {
+        BTreeLeaf left_node(file, parent->get_child(left), key_profile, false);
+        BTreeLeaf right_node(file, parent->get_child(left + 1), key_profile, false);
+        left_node.absorb(right_node);  // whether they fit together depends on the prefix they'd share
+        if (left_node.used_bytes() <= BTreeNode::NODE_ROOM) {
+            parent->remove_child(left + 1);
+        } else {
+            left_node.set_next_leaf(right_node.get_id());
+            parent->set_boundary(left, left_node.balance(right_node));
+            right_node.save();
+        }
+        left_node.save();
+    } else {
+        BTreeInterior left_node(file, parent->get_child(left), key_profile, false);
+        BTreeInterior right_node(file, parent->get_child(left + 1), key_profile, false);
+        if (left_node.used_bytes() + BTreeInterior::entry_size(separator) + right_node.used_bytes() <=
+            BTreeNode::NODE_ROOM) {
+            left_node.absorb(right_node, separator);
+            parent->remove_child(left + 1);
+        } else {
+            parent->set_boundary(left, left_node.balance(right_node, separator));
+            right_node.save();
+        }
+        left_node.save();
+    }
+    parent->save();
+}
+
+BTreeFile::~BTreeFile() {
+    clear_cache();
+}
+
+void BTreeFile::drop() {
+    clear_cache();
+    HeapFile::drop();
+}
+
+void BTreeFile::close() {
+    clear_cache();
+    HeapFile::close();
+}
+
+// Write the block back and forget any decoded copy of it.
+void BTreeFile::put(DbBlock *block) {
+    auto cached = this->nodes.find(block->get_block_id());
+    if (cached != this->nodes.end()) {
+        delete cached->second;
+        this->nodes.erase(cached);
+    }
+    HeapFile::put(block);
+}
+
+const BTreeInterior *BTreeFile::get_interior(BlockID block_id, const KeyProfile &key_profile) {
+    auto cached = this->nodes.find(block_id);
+    if (cached != this->nodes.end()) {
+        this->hits++;
+        return cached->second;
+    }
+    this->misses++;
+    if (this->nodes.size() >= CACHE_SIZE)
+        clear_cache();
+    auto *node = new BTreeInterior(*this, block_id, key_profile, false);
+    node->detach();
+    this->nodes[block_id] = node;
+    return node;
+}
+
+void BTreeFile::clear_cache() {
+    for (auto const &cached: this->nodes)
+        delete cached.second;
+    this->nodes.clear();
 }
 
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
@@ -145,6 +534,20 @@ KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
     return key_value;
 }
 
+// The key values from the ValueDict, marshalled for the nodes.
+KeyBytes BTreeIndex::marshal_key(const ValueDict *key) const {
+    KeyValue *key_value = tkey(key);
+    KeyBytes bytes;
+    try {
+        bytes = BTreeNode::marshal_key(this->key_profile, *key_value);
+    } catch (DbRelationError &e) {
+        delete key_value;
+        throw;
+    }
+    delete key_value;
+    return bytes;
+}
+
 // Figure out the data types of each key component and encode them in key_profile, a list of int/str classes.
 void BTreeIndex::build_key_profile() {
     std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
@@ -159,6 +562,37 @@ void BTreeIndex::build_key_profile() {
 }
 
 bool test_btree() {
+    // marshalled keys sort the way the keys do
+    KeyProfile profile;
+    profile.push_back(ColumnAttribute::TEXT);
+    profile.push_back(ColumnAttribute::INT);
+    std::vector<KeyValue> sorted;
+    for (auto const &s: {std::string(""), std::string("a"), std::string("a\0", 2), std::string("ab")})
+        for (int n: {INT32_MIN, -1, 0, 1, INT32_MAX}) {
+            KeyValue key;
+            key.push_back(Value(s));
+            key.push_back(Value(n));
+            sorted.push_back(key);
+        }
+    for (uint i = 0; i < sorted.size(); i++) {
+        KeyBytes bytes = BTreeNode::marshal_key(profile, sorted[i]);
+        if (BTreeNode::unmarshal_key(profile, bytes) != sorted[i]) {
+            std::cout << "key marshalling failed " << i << std::endl;
+            return false;
+        }
+        if (i > 0 && !(BTreeNode::marshal_key(profile, sorted[i - 1]) < bytes)) {
+            std::cout << "marshalled key order failed " << i << std::endl;
+            return false;
+        }
+        if (i > 0) {
+            KeyBytes separator = BTreeNode::separator(BTreeNode::marshal_key(profile, sorted[i - 1]), bytes);
+            if (!(BTreeNode::marshal_key(profile, sorted[i - 1]) < separator && separator <= bytes)) {
+                std::cout << "separator failed " << i << std::endl;
+                return false;
+            }
+        }
+    }
+
     ColumnNames column_names;
     column_names.push_back("a");
     column_names.push_back("b");
@@ -230,36 +664,72 @@ bool test_btree() {
             delete handles;
             delete result;
         }
-   
-    // fix me when delete and range are implemented.
-    index.drop();
-    table.drop();
-    return true; 
 
-    // test delete
-    ValueDict row;
-    row["a"] = 44;
-    row["b"] = 44;
-    auto thandle = table.insert(&row);
-    index.insert(thandle);
-    lookup["a"] = 44;
-    handles = index.lookup(&lookup);
-    thandle = handles->back();
-    delete handles;
-    result = table.project(thandle);
-    if (*result != row) {
-        std::cout << "44 lookup failed" << std::endl;
+    // bulk load packed loosely enough to need interior nodes
+    column_names.clear();
+    column_names.push_back("b");
+    BTreeIndex bindex(table, "barindex", column_names, true);
+    bindex.set_fill_factor(10);
+    bindex.create();
+    for (int i = 0; i < 100; i++) {
+        lookup.clear();
+        lookup["b"] = -i;
+        handles = bindex.lookup(&lookup);
+        if (handles->size() != 1) {
+            std::cout << "bulk loaded lookup failed " << i << std::endl;
+            return false;
+        }
+        result = table.project(handles->back());
+        delete handles;
+        if ((*result)["a"] != Value(i + 100)) {
+            std::cout << "bulk loaded lookup found wrong row " << i << std::endl;
+            return false;
+        }
+        delete result;
+    }
+    if (bindex.get_file().get_cache_misses() != 1 || bindex.get_file().get_cache_hits() != 99) {
+        std::cout << "interior node cache missed: " << bindex.get_file().get_cache_misses() << std::endl;
         return false;
     }
-    delete result;
-    index.del(thandle);
-    table.del(thandle);
-    handles = index.lookup(&lookup);
-    if (handles->size() != 0) {
-        std::cout << "delete failed" << std::endl;
+    ValueDict low, high;
+    low["b"] = -50;
+    high["b"] = 99;
+    handles = bindex.range(&low, &high);  // crosses several leaves
+    u_long count = handles->size();
+    delete handles;
+    if (count != 52) {
+        std::cout << "bulk loaded range failed " << count << std::endl;
         return false;
     }
+
+    // deleting most of the loosely packed index merges its underfull leaves
+    for (int i = 10; i < 100; i++) {
+        lookup.clear();
+        lookup["b"] = -i;
+        handles = bindex.lookup(&lookup);
+        bindex.del(handles->back());
+        delete handles;
+    }
+    handles = bindex.range(nullptr, nullptr);
+    count = handles->size();
     delete handles;
+    if (count != 12) {
+        std::cout << "delete with merging left " << count << " entries" << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 10; i++) {
+        lookup.clear();
+        lookup["b"] = -i;
+        handles = bindex.lookup(&lookup);
+        count = handles->size();
+        delete handles;
+        if (count != 1) {
+            std::cout << "lookup after delete with merging failed " << i << std::endl;
+            return false;
+        }
+    }
+    bindex.drop();
+    lookup.clear();
 
     // test range
     ValueDict minkey, maxkey;
@@ -267,7 +737,11 @@ bool test_btree() {
     maxkey["a"] = 310;
     handles = index.range(&minkey, &maxkey);
     ValueDicts *results = table.project(handles);
-    for (int i = 0; i < 210; i++) {
+    if (results->size() != 100) {
+        std::cout << "range failed: " << results->size() << " rows" << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 100; i++) {
         if (results->at(i)->at("a") != Value(100 + i)) {
             ValueDict *wrong = results->at(i);
             std::cout << "range failed: " << i << ", a: " << wrong->at("a").n << ", b: " << wrong->at("b").n
@@ -280,6 +754,26 @@ bool test_btree() {
         delete vd;
     delete results;
 
+    // exclusive bounds and an open end, streamed
+    minkey["a"] = 88;
+    HandleCursor *rows = index.range_cursor(&minkey, nullptr, false, true);
+    Handle row_handle;
+    int expect = 100;
+    while (rows->next(row_handle)) {
+        result = table.project(row_handle);
+        bool ok = (*result)["a"] == Value(expect++);
+        delete result;
+        if (!ok) {
+            std::cout << "exclusive range failed: " << expect - 1 << std::endl;
+            return false;
+        }
+    }
+    delete rows;
+    if (expect != 200) {
+        std::cout << "exclusive range stopped early: " << expect << std::endl;
+        return false;
+    }
+
     // test range from beginning and to end
     handles = index.range(nullptr, nullptr);
     u_long count_i = handles->size();
@@ -290,6 +784,37 @@ bool test_btree() {
         std::cout << "full range failed: " << count_i << std::endl;
         return false;
     }
+
+    delete handles;
+
+    // test delete
+    ValueDict row;
+    row["a"] = 44;
+    row["b"] = 44;
+    auto thandle = table.insert(&row);
+    index.insert(thandle);
+    lookup["a"] = 44;
+    handles = index.lookup(&lookup);
+    thandle = handles->back();
+    delete handles;
+    result = table.project(thandle);
+    if (*result != row) {
+        std::cout << "44 lookup failed" << std::endl;
+        return false;
+    }
+    delete result;
+    index.del(thandle);
+    table.del(thandle);
+    handles = index.lookup(&lookup);
+    if (handles->size() != 0) {
+        std::cout << "delete failed" << std::endl;
+        return false;
+    }
+    delete handles;
+
+    // delete everything
+    handles = table.select();
+    count_t = handles->size();
     for (u_long i = 0; i < count_t; i++)
         index.del((*handles)[i]);
     delete handles;
@@ -303,6 +828,186 @@ bool test_btree() {
     
     index.drop();
     table.drop();
+
+    // non-unique index on a column with few values (long postings overflow the leaf)
+    ColumnNames status_columns;
+    status_columns.push_back("status");
+    ColumnAttributes status_attributes;
+    status_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable status_table("__test_btree_dups", status_columns, status_attributes);
+    status_table.create();
+    for (int i = 0; i < 3000; i++) {
+        ValueDict row;
+        row["status"] = Value(i % 3);
+        status_table.insert(&row);
+    }
+    BTreeIndex status_index(status_table, "statusindex", status_columns, false);
+    status_index.create();
+    lookup.clear();
+    lookup["status"] = 1;
+    handles = status_index.lookup(&lookup);
+    count = handles->size();
+    for (auto const &handle: *handles) {
+        result = status_table.project(handle);
+        bool ok = (*result)["status"] == Value(1);
+        delete result;
+        if (!ok) {
+            std::cout << "non-unique lookup found wrong row" << std::endl;
+            return false;
+        }
+    }
+    if (count != 1000) {
+        std::cout << "non-unique lookup failed: " << count << std::endl;
+        return false;
+    }
+    status_index.del(handles->front());
+    delete handles;
+    ValueDict status_row;
+    status_row["status"] = Value(7);
+    for (int i = 0; i < 3; i++)
+        status_index.insert(status_table.insert(&status_row));
+    handles = status_index.lookup(&lookup);
+    count = handles->size();
+    delete handles;
+    lookup["status"] = 7;
+    handles = status_index.lookup(&lookup);
+    if (count != 999 || handles->size() != 3) {
+        std::cout << "non-unique insert/delete failed: " << count << ", " << handles->size() << std::endl;
+        return false;
+    }
+    delete handles;
+    handles = status_index.range(&lookup, nullptr);
+    count = handles->size();
+    delete handles;
+    if (count != 3) {
+        std::cout << "non-unique range failed: " << count << std::endl;
+        return false;
+    }
+    status_index.drop();
+    status_table.drop();
+
+    // long keys with a lot in common: the leaves store it once and the boundaries only as much as they need
+    ColumnNames name_columns;
+    name_columns.push_back("name");
+    ColumnAttributes name_attributes;
+    name_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable name_table("__test_btree_names", name_columns, name_attributes);
+    name_table.create();
+    auto name = [](int i) {
+        char digits[16];
+        snprintf(digits, sizeof(digits), "%08d", i);
+        return Value(std::string("customer account number ") + digits);
+    };
+    Handles name_handles;
+    for (int i = 0; i < 4000; i += 2) {
+        ValueDict row;
+        row["name"] = name(i);
+        name_handles.push_back(name_table.insert(&row));
+    }
+    BTreeIndex name_index(name_table, "nameindex", name_columns, true);
+    name_index.create();
+    KeyValue long_key(1, name(0));
+    KeyBytes long_bytes = BTreeNode::marshal_key(KeyProfile(1, ColumnAttribute::TEXT), long_key);
+    uint entry_size = BTreeLeaf::entry_size(long_bytes, Posting(Handles(1, name_handles.front())));
+    uint unpacked_leaves = 2000 * entry_size / BTreeNode::NODE_ROOM;
+    if (name_index.get_file().get_last_block_id() * 2 > unpacked_leaves) {
+        std::cout << "prefix compression failed: " << name_index.get_file().get_last_block_id() << " blocks, "
+                  << unpacked_leaves << " leaves without it" << std::endl;
+        return false;
+    }
+    for (int i = 1; i < 4000; i += 2) {
+        ValueDict row;
+        row["name"] = name(i);
+        name_index.insert(name_table.insert(&row));
+    }
+    for (uint i = 0; i < name_handles.size(); i += 2)
+        name_index.del(name_handles[i]);
+    for (int i = 0; i < 4000; i++) {
+        lookup.clear();
+        lookup["name"] = name(i);
+        handles = name_index.lookup(&lookup);
+        count = handles->size();
+        delete handles;
+        if (count != (i % 4 == 0 ? 0UL : 1UL)) {
+            std::cout << "long key lookup failed " << i << ": " << count << std::endl;
+            return false;
+        }
+    }
+    handles = name_index.range(nullptr, nullptr);
+    count = handles->size();
+    delete handles;
+    if (count != 3000) {
+        std::cout << "long key range failed: " << count << std::endl;
+        return false;
+    }
+    name_index.drop();
+    name_table.drop();
+
+    // increasing keys go straight onto the last leaf, and the leaves they fill are left as full as a bulk load's
+    ColumnNames id_columns;
+    id_columns.push_back("id");
+    ColumnAttributes id_attributes;
+    id_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable id_table("__test_btree_seq", id_columns, id_attributes);
+    id_table.create();
+    BTreeIndex seq_index(id_table, "seqindex", id_columns, true);
+    seq_index.create();
+    for (int i = 0; i < 5000; i++) {
+        ValueDict row;
+        row["id"] = Value(i * 3);
+        seq_index.insert(id_table.insert(&row));
+    }
+    BTreeIndex id_index(id_table, "idindex", id_columns, true);
+    id_index.create();
+    u_long descents = seq_index.get_file().get_cache_hits() + seq_index.get_file().get_cache_misses();
+    uint seq_blocks = seq_index.get_file().get_last_block_id();
+    uint bulk_blocks = id_index.get_file().get_last_block_id();
+    if (descents > 500 || seq_blocks > bulk_blocks * 11 / 10 + 2) {
+        std::cout << "sequential insert failed: " << descents << " interior reads, " << seq_blocks << " blocks vs. "
+                  << bulk_blocks << " bulk loaded" << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 15000; i++) {
+        lookup.clear();
+        lookup["id"] = Value(i);
+        handles = seq_index.lookup(&lookup);
+        count = handles->size();
+        delete handles;
+        if (count != (i % 3 == 0 ? 1UL : 0UL)) {
+            std::cout << "sequential insert lookup failed " << i << std::endl;
+            return false;
+        }
+    }
+
+    // a batch of keys (in no particular order, some missing, one twice) walks the leaves once
+    ValueDicts probes;
+    for (int i = 0; i < 3000; i++) {
+        auto *probe = new ValueDict();
+        (*probe)["id"] = Value((i * 7919) % 3000 * 5);
+        probes.push_back(probe);
+    }
+    probes.push_back(new ValueDict(*probes.front()));
+    descents = seq_index.get_file().get_cache_hits() + seq_index.get_file().get_cache_misses();
+    HandleLists *batch = seq_index.lookup_batch(probes);
+    descents = seq_index.get_file().get_cache_hits() + seq_index.get_file().get_cache_misses() - descents;
+    bool batch_ok = batch->size() == probes.size() && descents < 10;
+    for (uint i = 0; i < probes.size(); i++) {
+        if (batch_ok) {
+            handles = seq_index.lookup(probes[i]);
+            batch_ok = *handles == *(*batch)[i];
+            delete handles;
+        }
+        delete (*batch)[i];
+        delete probes[i];
+    }
+    delete batch;
+    if (!batch_ok) {
+        std::cout << "batch lookup failed: " << descents << " interior reads" << std::endl;
+        return false;
+    }
+    id_index.drop();
+    seq_index.drop();
+    id_table.drop();
     return true;
     
 }
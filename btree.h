@@ -8,6 +8,47 @@
 
 #include "BTreeNode.h"
 
+/**
+ * @class BTreeFile - the HeapFile of a BTreeIndex, along with a cache of its decoded interior nodes
+ *
+ * Lookups descend through cached copies of the interior nodes, which are already unmarshalled and don't hold a
+ * pin on their blocks, so a lookup on a warm index only reads its leaf. Writing a block back with put() drops
+ * any cached copy of it. At most CACHE_SIZE nodes are kept; the cache is emptied when it fills up.
+ */
+class BTreeFile : public HeapFile {
+public:
+    static const uint CACHE_SIZE = 256;
+
+    BTreeFile(std::string name) : HeapFile(name), nodes(), hits(0), misses(0) {}
+
+    virtual ~BTreeFile();
+
+    virtual void drop(void);
+
+    virtual void close(void);
+
+    virtual void put(DbBlock *block);
+
+    /**
+     * Get the decoded interior node in a block, reading it in if it isn't cached.
+     * @param block_id     the node's block
+     * @param key_profile  the index's key profile
+     * @returns            a detached node (owned by the cache; good until the next put() or get_interior())
+     */
+    const BTreeInterior *get_interior(BlockID block_id, const KeyProfile &key_profile);
+
+    u_long get_cache_hits() const { return hits; }
+
+    u_long get_cache_misses() const { return misses; }
+
+protected:
+    std::map<BlockID, BTreeInterior *> nodes;
+    u_long hits;
+    u_long misses;
+
+    void clear_cache();
+};
+
 class BTreeIndex : public DbIndex {
 public:
     BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
@@ -24,27 +65,99 @@ public:
 
     virtual Handles *lookup(ValueDict *key) const;
 
+    virtual HandleLists *lookup_batch(const ValueDicts &keys) const;
+
     virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
 
+    virtual HandleCursor *range_cursor(const ValueDict *min_key, const ValueDict *max_key, bool min_inclusive = true,
+                                       bool max_inclusive = true) const;
+
     virtual void insert(Handle handle);
 
     virtual void del(Handle handle);
 
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
 
+    /**
+     * Percentage of each node's room that create() fills when it bulk loads the index (default 90).
+     * Leaving some room means the first inserts afterwards don't all split.
+     * @param percent  10 to 100
+     */
+    void set_fill_factor(uint percent);
+
+    uint get_fill_factor() const { return fill_factor; }
+
+    /**
+     * Percentage of a node's room below which del() merges it with (or borrows from) a sibling (default 30).
+     * @param percent  0 (never merge) to 50
+     */
+    void set_min_fill(uint percent);
+
+    uint get_min_fill() const { return min_fill; }
+
+    const BTreeFile &get_file() const { return file; }
+
 protected:
     static const BlockID STAT = 1;
+    static const uint DEFAULT_FILL_FACTOR = 90;
+    static const uint DEFAULT_MIN_FILL = 30;
     bool closed;
     BTreeStat *stat;
     BTreeNode *root;
-    HeapFile file;
+    mutable BTreeFile file;  // lookups read (and pin) its blocks, and cache its interior nodes
     KeyProfile key_profile;
+    uint fill_factor;
+    uint min_fill;
+    BlockPointers rightmost;  // the nodes from the root down to the last leaf (empty until append() needs them)
 
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    void bulk_load();
+
+    bool _del(BTreeNode *node, uint height, const KeyBytes &key, Handle handle);
+
+    void rebalance(BTreeInterior *parent, uint index, uint height);
+
+    bool append(const KeyBytes &key, Handle handle, Insertion &insertion);
+
+    Insertion _insert(BTreeNode *node, uint height, const KeyBytes &key, Handle handle);
+
+    BTreeLeaf *find_leaf(const KeyBytes *key) const;
+
+    KeyBytes marshal_key(const ValueDict *key) const;
+
+    friend class BTreeRangeCursor;
+};
 
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+/**
+ * @class BTreeRangeCursor - walks the leaf chain of a BTreeIndex from the start of a key range to its end
+ *
+ * Only the current leaf (and the posting of the current key) is held; the next one is read when the current one
+ * runs out, so handles come back in key order as they are found and the scan stops at the first key past the
+ * end of the range.
+ */
+class BTreeRangeCursor : public HandleCursor {
+public:
+    BTreeRangeCursor(const BTreeIndex &index, const KeyBytes *min_key, const KeyBytes *max_key, bool min_inclusive,
+                     bool max_inclusive);
+
+    virtual ~BTreeRangeCursor();
+
+    BTreeRangeCursor(const BTreeRangeCursor &other) = delete;
+
+    BTreeRangeCursor &operator=(const BTreeRangeCursor &other) = delete;
+
+    virtual bool next(Handle &handle);
+
+protected:
+    const BTreeIndex &index;
+    KeyBytes max_key;
+    bool bounded;  // whether there is a max_key
+    bool max_inclusive;
+    BTreeLeaf *leaf;  // nullptr once the range is used up
+    uint position;  // next entry of the leaf
+    Handles posting;  // handles of the entry before position
+    uint in_posting;  // next one of them to return
 };
 
 bool test_btree();
@@ -49,6 +49,7 @@ bool is_acceptable_data_type(std::string dt) {
  */
 const Identifier Tables::TABLE_NAME = "_tables";
 Columns *Tables::columns_table = nullptr;
+Indices *Tables::indices_table = nullptr;
 std::map<Identifier, DbRelation *> Tables::table_cache;
 
 // get the column name for _tables column
@@ -75,6 +76,9 @@ Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
     if (Tables::columns_table == nullptr)
         columns_table = new Columns();
     Tables::table_cache[columns_table->TABLE_NAME] = columns_table;
+    if (Tables::indices_table == nullptr)
+        indices_table = new Indices();
+    Tables::table_cache[indices_table->TABLE_NAME] = indices_table;
 }
 
 // Create the file and also, manually add schema tables.
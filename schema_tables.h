@@ -18,6 +18,7 @@ void initialize_schema_tables();
 
 
 class Columns; // forward declare
+class Indices;
 
 /**
  * @class Tables - The singleton table that stores the metadata for all other tables.
@@ -69,6 +70,9 @@ protected:
     // keep a reference to the columns table (for get_columns method)
     static Columns *columns_table;
 
+    // keep the one indices table, so get_table(Indices::TABLE_NAME) shares its HeapFile (and buffer frames)
+    static Indices *indices_table;
+
 private:
     // keep a cache of all the tables we've instantiated so far
     static std::map<Identifier, DbRelation *> table_cache;
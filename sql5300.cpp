@@ -10,13 +10,15 @@
 #include "SQLParser.h"
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
+#include "BufferPool.h"
 #include "btree.h"
+#include "EvalPlan.h"
 
 using namespace std;
 using namespace hsql;
 
 /*
- * we allocate and initialize the _DB_ENV global
+ * we allocate and initialize the _DB_ENV and _BUFFER_POOL globals
  */
 void initialize_environment(char *envHome);
 
@@ -41,11 +43,15 @@ int main(int argc, char *argv[]) {
         getline(cin, query);
         if (query.length() == 0)
             continue;  // blank line -- just skip
-        if (query == "quit")
+        if (query == "quit") {
+            _BUFFER_POOL->flush_all();  // get any dirty blocks out to Berkeley DB before we go
             break;  // only way to get out
+        }
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+            cout << "test_eval_plan: " << (test_eval_plan() ? "ok" : "failed") << endl;
+            cout << "test_sql_join: " << (test_sql_join() ? "ok" : "failed") << endl;
             continue;
         }
 
@@ -73,6 +79,7 @@ int main(int argc, char *argv[]) {
 }
 
 DbEnv *_DB_ENV;
+BufferPool *_BUFFER_POOL;
 
 void initialize_environment(char *envHome) {
     cout << "(sql5300: running with database environment at " << envHome << ")" << endl;
@@ -87,5 +94,6 @@ void initialize_environment(char *envHome) {
         exit(1);
     }
     _DB_ENV = env;
+    _BUFFER_POOL = new BufferPool();
     initialize_schema_tables();
 }
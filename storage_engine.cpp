@@ -5,19 +5,62 @@
  */
 #include <algorithm>
 #include "storage_engine.h"
+#include "RowBatch.h"
 
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s == other.s;
+    return this->n == other.n;  // INT or BOOLEAN
 }
 
 bool Value::operator!=(const Value &other) const {
     return !(*this == other);
 }
 
+bool Comparison::matches(const Value &column_value) const {
+    if (this->op == IN) {
+        for (auto const &value: this->values)
+            if (value == column_value)
+                return true;
+        return false;
+    }
+    if (column_value.data_type != this->value.data_type)
+        return false;
+    if (this->value.data_type == ColumnAttribute::TEXT)
+        return holds(column_value.s.compare(this->value.s));
+    return holds(column_value.n < this->value.n ? -1 : (column_value.n > this->value.n ? 1 : 0));
+}
+
+bool Comparison::holds(Op op, int cmp) {
+    switch (op) {
+        case EQ:
+            return cmp == 0;
+        case NE:
+            return cmp != 0;
+        case LT:
+            return cmp < 0;
+        case LE:
+            return cmp <= 0;
+        case GT:
+            return cmp > 0;
+        case GE:
+            return cmp >= 0;
+        case IN:
+            return cmp == 0;
+    }
+    return false;
+}
+
+Comparisons equalities(const ValueDict *where) {
+    Comparisons comparisons;
+    if (where != nullptr)
+        for (auto const &predicate: *where)
+            comparisons.push_back(Comparison(predicate.first, Comparison::EQ, predicate.second));
+    return comparisons;
+}
+
 bool Value::operator<(const Value &other) const {
     if (this->data_type != other.data_type) {
         // arbitrary ordering of data types: BOOLEAN < INT < TEXT
@@ -49,6 +92,50 @@ std::ostream &operator<<(std::ostream &out, const Value &value) {
 }
 
 
+// Walk through the list
+bool HandlesCursor::next(Handle &handle) {
+    if (this->handles == nullptr || this->position >= this->handles->size())
+        return false;
+    handle = (*this->handles)[this->position++];
+    return true;
+}
+
+
+/**
+ * Fills batches by projecting the relation's rows one at a time.
+ */
+class ProjectingBatchCursor : public BatchCursor {
+public:
+    ProjectingBatchCursor(DbRelation &relation, const ColumnNames *column_names) : relation(relation),
+                                                                                  column_names(column_names),
+                                                                                  rows(relation.cursor()) {}
+
+    virtual ~ProjectingBatchCursor() { delete rows; }
+
+    ProjectingBatchCursor(const ProjectingBatchCursor &other) = delete;
+
+    ProjectingBatchCursor &operator=(const ProjectingBatchCursor &other) = delete;
+
+    virtual bool next(RowBatch &batch) {
+        batch.clear();
+        Handle handle;
+        while (!batch.full() && rows->next(handle)) {
+            ValueDict *row = relation.project(handle, column_names);
+            batch.add_row(handle);
+            for (uint i = 0; i < column_names->size(); i++)
+                batch.column(i).append(row->at((*column_names)[i]));
+            delete row;
+        }
+        return batch.size() > 0;
+    }
+
+protected:
+    DbRelation &relation;
+    const ColumnNames *column_names;
+    HandleCursor *rows;
+};
+
+
 // Get only selected column attributes
 ColumnAttributes *DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -64,6 +151,95 @@ ColumnAttributes *DbRelation::get_column_attributes(const ColumnNames &select_co
     return ret;
 }
 
+// Fallback cursor just materializes the selection
+HandleCursor *DbRelation::cursor(const ValueDict *where) {
+    return new HandlesCursor(select(where));
+}
+
+// Turn an all-equality conjunction back into column/value pairs (nullptr for nullptr). Returns false if it gives
+// a column two different values, so no row can match.
+static bool equality_dict(const Comparisons *where, ValueDict *&dict) {
+    dict = nullptr;
+    if (where == nullptr)
+        return true;
+    dict = new ValueDict();
+    for (auto const &comparison: *where) {
+        if (comparison.op != Comparison::EQ) {
+            delete dict;
+            dict = nullptr;
+            throw DbRelationError("only equality predicates are supported on this relation");
+        }
+        auto given = dict->find(comparison.column_name);
+        if (given != dict->end() && given->second != comparison.value) {
+            delete dict;
+            dict = nullptr;
+            return false;
+        }
+        (*dict)[comparison.column_name] = comparison.value;
+    }
+    return true;
+}
+
+Handles *DbRelation::select(const Comparisons *where) {
+    ValueDict *dict;
+    if (!equality_dict(where, dict))
+        return new Handles();
+    Handles *handles = select(dict);
+    delete dict;
+    return handles;
+}
+
+Handles *DbRelation::select(Handles *current_selection, const Comparisons *where) {
+    ValueDict *dict;
+    if (!equality_dict(where, dict))
+        return new Handles();
+    Handles *handles = select(current_selection, dict);
+    delete dict;
+    return handles;
+}
+
+HandleCursor *DbRelation::cursor(const Comparisons *where) {
+    return new HandlesCursor(select(where));
+}
+
+Handles *merge_handles(HandleLists &lists) {
+    Handles *handles = new Handles();
+    for (auto list: lists) {
+        handles->insert(handles->end(), list->begin(), list->end());
+        delete list;
+    }
+    std::sort(handles->begin(), handles->end());
+    handles->erase(std::unique(handles->begin(), handles->end()), handles->end());
+    return handles;
+}
+
+Handles *DbRelation::select(const Disjunction *where) {
+    if (where == nullptr)
+        return select();
+    HandleLists lists;
+    for (auto const &conjunction: *where)
+        lists.push_back(select(&conjunction));
+    return merge_handles(lists);
+}
+
+Handles *DbRelation::select(Handles *current_selection, const Disjunction *where) {
+    if (where == nullptr)
+        return new Handles(*current_selection);
+    HandleLists lists;
+    for (auto const &conjunction: *where)
+        lists.push_back(select(current_selection, &conjunction));
+    return merge_handles(lists);
+}
+
+HandleCursor *DbRelation::cursor(const Disjunction *where) {
+    return new HandlesCursor(select(where));
+}
+
+// Fallback batch cursor goes through project()
+BatchCursor *DbRelation::batch_cursor(const ColumnNames *column_names) {
+    return new ProjectingBatchCursor(*this, column_names);
+}
+
 // Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     ColumnNames t;
@@ -72,12 +248,9 @@ ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     return this->project(handle, &t);
 }
 
-// Do a projection for each of a list of handles
+// Do a projection of all the columns for each of a list of handles
 ValueDicts *DbRelation::project(Handles *handles) {
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle));
-    return ret;
+    return project(handles, &this->column_names);
 }
 
 // Do a projection for each of a list of handles
@@ -88,13 +261,10 @@ ValueDicts *DbRelation::project(Handles *handles, const ColumnNames *column_name
     return ret;
 }
 
-// Do a projection for each of a list of handles
+// Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
     ColumnNames t;
     for (auto const &column: *where)
         t.push_back(column.first);
-    ValueDicts *ret = new ValueDicts();
-    for (auto const &handle: *handles)
-        ret->push_back(project(handle, &t));
-    return ret;
+    return project(handles, &t);
 }
@@ -3,6 +3,7 @@
  * DbBlock
  * DbFile
  * DbRelation
+ * BlockIDCursor, HandleCursor, BatchCursor
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
@@ -134,7 +135,22 @@ protected:
 };
 
 // convenience type alias
-typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<BlockID> BlockIDs;  // materialized list; use a BlockIDCursor to walk a file block by block
+
+/**
+ * @class BlockIDCursor - abstract pull-based iterator over the BlockIDs of a DbFile
+ */
+class BlockIDCursor {
+public:
+    virtual ~BlockIDCursor() {}
+
+    /**
+     * Advance to the next block.
+     * @param block_id  set to the next BlockID (if there is one)
+     * @returns         false if there are no more blocks
+     */
+    virtual bool next(BlockID &block_id) = 0;
+};
 
 /**
  * @class DbFile - abstract base class which represents a disk-based collection of DbBlocks
@@ -146,6 +162,7 @@ typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an
  *	get(block_id)
  *	put(block)
  *	block_ids()
+ *	block_cursor()
  */
 class DbFile {
 public:
@@ -195,11 +212,17 @@ public:
 
     /**
      * Get a list of all the valid BlockID's in the file
-     * FIXME - not a good long-term approach, but we'll do this until we put in iterators
+     * (builds the whole list up front -- prefer block_cursor() for scans)
      * @returns  a pointer to vector of BlockIDs (freed by caller)
      */
     virtual BlockIDs *block_ids() const = 0;
 
+    /**
+     * Get a cursor over all the valid BlockID's in the file without building a list of them.
+     * @returns  a pointer to a new cursor (freed by caller)
+     */
+    virtual BlockIDCursor *block_cursor() const = 0;
+
 protected:
     std::string name;  // filename (or part of it)
 };
@@ -258,9 +281,123 @@ typedef std::string Identifier;
 typedef std::vector<Identifier> ColumnNames;
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
-typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<Handle> Handles;  // materialized list; use a HandleCursor to stream through a relation
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
+typedef std::vector<Handles *> HandleLists;  // one list of handles for each of a series of keys
+
+
+/**
+ * @class Comparison - one predicate of a where clause: a column compared with a value (or, for IN, a list of them)
+ */
+class Comparison {
+public:
+    enum Op {
+        EQ, NE, LT, LE, GT, GE, IN
+    };
+
+    Comparison(Identifier column_name, Op op, Value value) : column_name(column_name), op(op), value(value),
+                                                             values() {}
+
+    Comparison(Identifier column_name, std::vector<Value> values) : column_name(column_name), op(IN), value(),
+                                                                    values(values) {}
+
+    /**
+     * Whether the predicate holds for a value of the column.
+     * @param column_value  the column's value (a value of a different data type never matches)
+     */
+    bool matches(const Value &column_value) const;
+
+    /**
+     * Whether the predicate holds, given how the column's value compares with ours.
+     * @param cmp  negative, zero, or positive as the column's value sorts before, with, or after value
+     *             (for IN, one of the values)
+     */
+    bool holds(int cmp) const { return holds(this->op, cmp); }
+
+    static bool holds(Op op, int cmp);
+
+    Identifier column_name;
+    Op op;
+    Value value;  // for all but IN
+    std::vector<Value> values;  // for IN
+};
+
+typedef std::vector<Comparison> Comparisons;  // a conjunction: all of them have to hold
+typedef std::vector<Comparisons> Disjunction;  // a where clause with ORs: any one of the conjunctions has to hold
+
+/**
+ * The equality predicates of a where clause given as column/value pairs.
+ * @param where  column/value pairs (nullptr for none)
+ * @returns      a comparison for each pair
+ */
+Comparisons equalities(const ValueDict *where);
+
+/**
+ * Merge lists of handles into one, in handle order and without duplicates (e.g., the rows of each of the
+ * conjunctions of a where clause with ORs).
+ * @param lists  the lists (freed here)
+ * @returns      the merged list (freed by caller)
+ */
+Handles *merge_handles(HandleLists &lists);
+
+
+/**
+ * @class HandleCursor - abstract pull-based iterator over the handles of the qualifying rows of a DbRelation
+ */
+class HandleCursor {
+public:
+    virtual ~HandleCursor() {}
+
+    /**
+     * Advance to the next qualifying row.
+     * @param handle  set to the next row's handle (if there is one)
+     * @returns       false if there are no more rows
+     */
+    virtual bool next(Handle &handle) = 0;
+};
+
+
+/**
+ * @class HandlesCursor - HandleCursor over an already materialized list of handles
+ */
+class HandlesCursor : public HandleCursor {
+public:
+    /**
+     * @param handles  list to walk through (we take ownership and free it)
+     */
+    explicit HandlesCursor(Handles *handles) : handles(handles), position(0) {}
+
+    virtual ~HandlesCursor() { delete handles; }
+
+    HandlesCursor(const HandlesCursor &other) = delete;
+
+    HandlesCursor &operator=(const HandlesCursor &other) = delete;
+
+    virtual bool next(Handle &handle);
+
+protected:
+    Handles *handles;
+    size_t position;
+};
+
+
+class RowBatch;  // see RowBatch.h
+
+/**
+ * @class BatchCursor - abstract pull-based iterator that fills RowBatches from a DbRelation
+ */
+class BatchCursor {
+public:
+    virtual ~BatchCursor() {}
+
+    /**
+     * Clear the batch and refill it with as many of the next rows as fit.
+     * @param batch  batch to fill (its columns are the ones the cursor was opened for)
+     * @returns      false if there were no more rows (the batch is left empty)
+     */
+    virtual bool next(RowBatch &batch) = 0;
+};
 
 
 /**
@@ -288,6 +425,12 @@ public:
  *	del(handle)
  *	select()
  *	select(where)
+ *	cursor(where)
+ *	select(comparisons)
+ *	cursor(comparisons)
+ *	select(disjunction)
+ *	cursor(disjunction)
+ *	batch_cursor(column_names)
  *	project(handle)
  *	project(handle, column_names)
  */
@@ -374,6 +517,47 @@ public:
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+     * but hand back the qualifying handles one at a time instead of as a list.
+     * The default just walks the result of select(where); subclasses should stream.
+     * @param where  where-clause predicates (nullptr for all rows); must outlive the cursor
+     * @returns      a pointer to a new cursor over the qualifying rows (freed by caller)
+     */
+    virtual HandleCursor *cursor(const ValueDict *where = nullptr);
+
+    /**
+     * Versions of select and cursor that take any kind of comparisons. The defaults only know how to do
+     * equality, by handing the conjunction to the ValueDict versions.
+     * @param where  predicates that must all hold
+     * @throws       DbRelationError for a comparison other than equality
+     */
+    virtual Handles *select(const Comparisons *where);
+
+    virtual Handles *select(Handles *current_selection, const Comparisons *where);
+
+    virtual HandleCursor *cursor(const Comparisons *where);
+
+    /**
+     * Versions of select and cursor for a where clause with ORs. The defaults select each conjunction in turn
+     * and merge the results; subclasses should check each row against all of them in one pass.
+     * @param where  conjunctions one of which must hold
+     * @returns      handles in handle order, each just once
+     */
+    virtual Handles *select(const Disjunction *where);
+
+    virtual Handles *select(Handles *current_selection, const Disjunction *where);
+
+    virtual HandleCursor *cursor(const Disjunction *where);
+
+    /**
+     * Read every row of the relation into column-oriented RowBatches (for vectorized evaluation).
+     * The default projects one handle at a time; subclasses should decode straight into the batch.
+     * @param column_names  columns to put in the batches (must outlive the cursor)
+     * @returns             a pointer to a new cursor (freed by caller)
+     */
+    virtual BatchCursor *batch_cursor(const ColumnNames *column_names);
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -488,6 +672,18 @@ public:
      */
     virtual Handles *lookup(ValueDict *key_values) const = 0;
 
+    /**
+     * Lookup a series of search keys all at once. The default just does them one by one.
+     * @param keys  dictionaries of values for the search keys
+     * @returns     list of DbFile handles for each key, in the same order as keys (freed by caller, lists too)
+     */
+    virtual HandleLists *lookup_batch(const ValueDicts &keys) const {
+        HandleLists *results = new HandleLists();
+        for (auto const &key: keys)
+            results->push_back(lookup(key));
+        return results;
+    }
+
     /**
      * Lookup a range of search keys.
      * @param min_key  dictionary of min (inclusive) search key
@@ -498,6 +694,22 @@ public:
         throw DbRelationError("range index query not supported");
     }
 
+    /**
+     * Streaming version of range, with a choice of inclusive or exclusive bounds.
+     * The default materializes range(), so it only handles inclusive bounds.
+     * @param min_key        dictionary of min search key (nullptr for no lower bound)
+     * @param max_key        dictionary of max search key (nullptr for no upper bound)
+     * @param min_inclusive  whether keys equal to min_key qualify
+     * @param max_inclusive  whether keys equal to max_key qualify
+     * @returns              cursor over handles for records in range, in key order (freed by caller)
+     */
+    virtual HandleCursor *range_cursor(const ValueDict *min_key, const ValueDict *max_key, bool min_inclusive = true,
+                                       bool max_inclusive = true) const {
+        if (!min_inclusive || !max_inclusive)
+            throw DbRelationError("exclusive range index query not supported");
+        return new HandlesCursor(range((ValueDict *) min_key, (ValueDict *) max_key));
+    }
+
     /**
      * Insert the index entry for the given record.
      * @param record  handle (into relation) to the record to insert
@@ -512,6 +724,30 @@ public:
      */
     virtual void del(Handle record) = 0;
 
+    /**
+     * Accessor method for the relation this index is on
+     * @returns  relation
+     */
+    virtual DbRelation &get_relation() const {
+        return relation;
+    }
+
+    /**
+     * Accessor method for key_columns
+     * @returns  the columns of the search key, in order
+     */
+    virtual const ColumnNames &get_key_columns() const {
+        return key_columns;
+    }
+
+    /**
+     * Accessor method for unique
+     * @returns  whether each search key is on at most one record
+     */
+    virtual bool is_unique() const {
+        return unique;
+    }
+
 protected:
     DbRelation &relation;
     Identifier name;
@@ -519,4 +755,6 @@ protected:
     bool unique;
 };
 
+typedef std::vector<DbIndex *> DbIndices;
+
 